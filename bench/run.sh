@@ -0,0 +1,98 @@
+#!/bin/sh
+# Builds listscriptV3.c and listscriptV6.c and runs every workload in bench/
+# on both, reporting ns/op, malloc calls, GC node allocations (V6 only) and
+# peak RSS. Usage: bench/run.sh [repetitions]   (default 3; the best time wins)
+#
+# A workload is name.ls; its first lines are ";" comments giving "ops: N",
+# the number of operations it performs, and optionally "expect: VALUE", the
+# last value it must print. listscriptV3.c runs name.v3.ls, since its if
+# form is written list(if ...); workloads in bench/ without one are reported
+# as n/a for it. The generated workloads run as they are on both. Comment
+# lines are stripped before a workload runs, as listscriptV3.c has no
+# comment syntax.
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(dirname "$BENCH_DIR")
+BUILD=${BUILD:-$BENCH_DIR/build}
+REPEAT=${1:-3}
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2}
+
+mkdir -p "$BUILD"
+$CC $CFLAGS -w "$ROOT/listscriptV3.c" -o "$BUILD/listscriptV3"
+$CC $CFLAGS -pthread "$ROOT/listscriptV6.c" -o "$BUILD/listscriptV6"
+$CC -O2 -shared -fPIC "$BENCH_DIR/alloc_count.c" -o "$BUILD/alloc_count.so"
+set +e
+
+# Generated workloads, too large to keep in the tree
+awk 'BEGIN {
+    print "; Many short string literals in data lists."
+    print "; ops: 60000"
+    for (i = 0; i < 3000; i++) {
+        line = "data("
+        for (j = 0; j < 20; j++) line = line sprintf("\"s%d_%d\" ", i, j)
+        print line ")"
+    }
+}' > "$BUILD/strings.ls"
+awk 'BEGIN {
+    print "; Parse-heavy: 20000 lines of nested data lists that evaluate to themselves."
+    print "; ops: 20000"
+    for (i = 0; i < 20000; i++) {
+        printf "data(sym%d %d data(a b c data(%d %d)) data(x y z) name%d data(1 2 3 4 5 6 7 8))\n", i, i, i, i + 1, i
+    }
+}' > "$BUILD/parse.ls"
+
+now_ns() { date +%s%N; }
+
+# Prints "ns mallocs nodes rss status" for one build on one workload
+measure() {
+    binary=$1 workload=$2
+    ops=$(sed -n 's/^; ops: *//p' "$workload")
+    expect=$(sed -n 's/^; expect: *//p' "$workload")
+    input="$BUILD/input.ls"
+    grep -v '^;' "$workload" > "$input"
+    case $binary in *V6) echo ":gc-stats" >> "$input" ;; esac
+    echo "bye" >> "$input"
+
+    best=""
+    for _ in $(seq "$REPEAT"); do
+        rm -f "$BUILD/report.txt"
+        start=$(now_ns)
+        BENCH_REPORT="$BUILD/report.txt" LD_PRELOAD="$BUILD/alloc_count.so" "$binary" < "$input" > "$BUILD/output.txt" 2>&1 || true
+        elapsed=$(( $(now_ns) - start ))
+        if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then best=$elapsed; fi
+    done
+
+    mallocs=$(sed -n 's/^mallocs //p' "$BUILD/report.txt" 2>/dev/null)
+    rss=$(sed -n 's/^maxrss_kb //p' "$BUILD/report.txt" 2>/dev/null)
+    nodes=$(sed -n 's/^nodes allocated: //p' "$BUILD/output.txt")
+    # The last value printed before the statistics and "Bye!"
+    last=$(sed -e 's/^\(-> \)*//' "$BUILD/output.txt" | grep -v '^$' | grep -v '^Bye!$' | grep -v ': ' | tail -n 1)
+    status=ok
+    if [ -z "$rss" ]; then status=crashed
+    elif grep -q 'Error' "$BUILD/output.txt"; then status=error
+    elif [ -n "$expect" ] && [ "$last" != "$expect" ]; then status="wrong:$last"
+    fi
+    ns_per_op=$(( best / ops ))
+    [ "$status" = ok ] || ns_per_op=-
+    echo "$ns_per_op ${mallocs:--} ${nodes:--} ${rss:--} $status"
+}
+
+printf '%-10s %-12s %10s %12s %12s %10s  %s\n' workload build ns/op mallocs nodes rss_kb status
+for workload in "$BENCH_DIR"/*.ls "$BUILD/strings.ls" "$BUILD/parse.ls"; do
+    case $workload in *.v3.ls) continue ;; esac
+    name=$(basename "$workload" .ls)
+    for version in V3 V6; do
+        file=$workload
+        if [ $version = V3 ] && [ "$(dirname "$workload")" = "$BENCH_DIR" ]; then
+            file=${workload%.ls}.v3.ls
+            if [ ! -f "$file" ]; then
+                printf '%-10s %-12s %10s %12s %12s %10s  %s\n' "$name" "listscript$version" - - - - n/a
+                continue
+            fi
+        fi
+        set -- $(measure "$BUILD/listscript$version" "$file")
+        printf '%-10s %-12s %10s %12s %12s %10s  %s\n' "$name" "listscript$version" "$1" "$2" "$3" "$4" "$5"
+    done
+done
@@ -0,0 +1,77 @@
+#ifndef LISTSCRIPT_H
+#define LISTSCRIPT_H
+
+// Embedding API for listscriptV6.c. Build the interpreter as an object with
+// -DLISTSCRIPT_NO_MAIN and link it into the host:
+//
+//     gcc -O2 -pthread -DLISTSCRIPT_NO_MAIN -c listscriptV6.c
+//
+// An ls_interp is one isolated interpreter. It may be used from any thread,
+// but by one thread at a time; run one per thread for parallelism.
+//
+// Values returned by the API live on the interpreter's collected heap. They
+// stay valid until the next ls_run or ls_call on the same interpreter; bind
+// a value with ls_define to keep it longer.
+
+typedef struct Interp ls_interp;
+typedef struct Node ls_value;
+typedef struct Script ls_script;
+
+// A host-defined primitive. args are already evaluated. It may be called
+// from pmap worker threads, so it must be thread-safe if scripts use it there.
+typedef ls_value *(*ls_primitive)(ls_interp *ls, ls_value **args, int arg_count);
+
+typedef enum {
+    LS_NUMBER,
+    LS_BOOLEAN,
+    LS_STRING,
+    LS_LIST,
+    LS_ERROR,
+    LS_FUNCTION,
+    LS_OTHER
+} ls_type;
+
+ls_interp *ls_new(void);
+void ls_free(ls_interp *ls);
+
+// Binds a global (a host primitive, or a value) before or after scripts load.
+// Returns 0 if the name is a constant: true, false or a defconst.
+int ls_register(ls_interp *ls, const char *name, ls_primitive fn);
+int ls_define(ls_interp *ls, const char *name, ls_value *value);
+
+// Parses and resolves a script once, without running it. Returns NULL on a
+// parse error.
+ls_script *ls_compile(ls_interp *ls, const char *source);
+// Runs the script's top-level forms, defining its functions. It can be run
+// again without re-parsing. Returns the first error, or else the last
+// form's value.
+ls_value *ls_run(ls_script *script);
+// Calls a global function or primitive of the script's interpreter
+ls_value *ls_call(ls_script *script, const char *fn, ls_value **args, int arg_count);
+
+// Saves a compiled script as an image file, to load without re-parsing.
+// Returns 0 if the file cannot be written.
+int ls_save_image(ls_script *script, const char *path);
+// Loads an image saved on a machine of the same byte order. Host primitives
+// it calls must be registered first. Its nodes are kept until ls_free.
+// Returns NULL if the file is not a valid image.
+ls_script *ls_load_image(ls_interp *ls, const char *path);
+
+ls_value *ls_number(ls_interp *ls, long number);
+ls_value *ls_boolean(ls_interp *ls, int value);
+ls_value *ls_string(ls_interp *ls, const char *string);
+ls_value *ls_list(ls_interp *ls, ls_value **items, int count);
+ls_value *ls_error(ls_interp *ls, const char *message);
+
+ls_type ls_typeof(ls_value *value);
+long ls_to_number(ls_value *value); // Numbers and booleans
+const char *ls_to_string(ls_value *value); // A string, or an error's message
+int ls_length(ls_value *value); // Of a list
+ls_value *ls_item(ls_value *value, int index);
+void ls_print(ls_value *value);
+
+// Frees the calling thread's evaluation stacks; call before a thread that
+// used an interpreter exits
+void ls_thread_exit(void);
+
+#endif
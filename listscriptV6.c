@@ -1,578 +1,5652 @@
-#include <stdint.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-#define debug(m,e) printf("%s:%d: %s:",__FILE__,__LINE__,m); print_obj(e,1); puts("");
-
-/* --- Data Structures --- */
-
-// Node types for the AST
-typedef enum {
-    DEF,
-    ARGS,
-    LIST,
-    DATA,
-    IF,
-    SYMBOL,
-    NUMBER,
-    PRIMITIVE_OP,
-    BOOLEAN,
-    ERROR,
-    FUNCTION_CALL,
-    STRING
-} NodeType;
-
-// A Node represents a single element in our program's AST.
-typedef struct Node {
-    NodeType type;
-    union {
-        // For SYMBOL, PRIMITIVE_OP, and ERROR nodes
-        char *name;
-        // For NUMBER and BOOLEAN nodes
-        long number;
-        // For LIST, ARGS, DEF, DATA, IF, FUNCTION_CALL nodes
-        struct {
-            struct Node **children;
-            int child_count;
-        } compound;
-        // For STRING nodes
-        char *string;
-    } value;
-} Node;
-
-// Forward declaration to fix the compiler warning
-void print_node(Node *node);
-
-// The Environment is a simple linked list mapping names to their Node values.
-typedef struct Env {
-    struct Env *next;
-    char *name;
-    struct Node *value;
-} Env;
-
-/* --- Core Functions --- */
-
-// Input buffer for the tokenizer.
-#define INPUT_MAX 1024
-static char input_buffer[INPUT_MAX];
-static int input_pos = 0;
-#define SYMBOL_MAX 32
-static char token[SYMBOL_MAX];
-
-// Tokenizer helpers
-int is_space(char x) { return x == ' ' || x == '\n' || x == '\t'; }
-int is_parens(char x) { return x == '(' || x == ')'; }
-int is_alpha(char x) { return (x >= 'a' && x <= 'z') || (x >= 'A' && x <= 'Z'); }
-int is_digit(char x) { return x >= '0' && x <= '9'; }
-
-// Reads a line from stdin into the buffer
-int read_line() {
-    if (fgets(input_buffer, INPUT_MAX, stdin)) {
-        input_pos = 0;
-        return 1;
-    }
-    return 0;
-}
-
-char peek_char() {
-    int i = input_pos;
-    while (is_space(input_buffer[i]) || input_buffer[i] == ';') {
-        if (input_buffer[i] == ';') {
-            while (input_buffer[i] != '\n' && input_buffer[i] != '\0') {
-                i++;
-            }
-        }
-        if (input_buffer[i] == '\0') break;
-        i++;
-    }
-    return input_buffer[i];
-}
-
-// Gets the next token from the buffer
-int gettoken() {
-    int index = 0;
-    while (is_space(input_buffer[input_pos]) || input_buffer[input_pos] == ';') {
-        if (input_buffer[input_pos] == ';') {
-            while (input_buffer[input_pos] != '\n' && input_buffer[input_pos] != '\0') {
-                input_pos++;
-            }
-        }
-        input_pos++;
-    }
-    if (input_buffer[input_pos] == '\0' || input_buffer[input_pos] == EOF) return 0;
-    
-    if (input_buffer[input_pos] == '"') {
-        input_pos++; // Consume the opening quote
-        while (input_buffer[input_pos] != '"' && input_buffer[input_pos] != '\0' && index < SYMBOL_MAX - 1) {
-            token[index++] = input_buffer[input_pos++];
-        }
-        if (input_buffer[input_pos] == '"') {
-            input_pos++; // Consume the closing quote
-        }
-    } else if (is_parens(input_buffer[input_pos])) {
-        token[index++] = input_buffer[input_pos++];
-    } else {
-        while (index < SYMBOL_MAX - 1 && input_buffer[input_pos] != '\0' && !is_space(input_buffer[input_pos]) && !is_parens(input_buffer[input_pos])) {
-            token[index++] = input_buffer[input_pos++];
-        }
-    }
-    token[index] = '\0';
-    return 1;
-}
-
-// Node creation functions (memory allocation helpers)
-Node *make_node(NodeType type) {
-    Node *node = calloc(1, sizeof(Node));
-    node->type = type;
-    return node;
-}
-
-Node *make_number(long num) {
-    Node *node = make_node(NUMBER);
-    node->value.number = num;
-    return node;
-}
-
-Node *make_symbol(char *name) {
-    Node *node = make_node(SYMBOL);
-    node->value.name = strdup(name);
-    return node;
-}
-
-Node *make_string(char *str) {
-    Node *node = make_node(STRING);
-    node->value.string = strdup(str);
-    return node;
-}
-
-Node *make_primitive_op(char *name) {
-    Node *node = make_node(PRIMITIVE_OP);
-    node->value.name = strdup(name);
-    return node;
-}
-
-Node *make_boolean(int value) {
-    Node *node = make_node(BOOLEAN);
-    node->value.number = value;
-    return node;
-}
-
-Node *make_error(char *message) {
-    Node *node = make_node(ERROR);
-    node->value.name = strdup(message);
-    return node;
-}
-
-Node *make_compound_node(NodeType type, int child_count) {
-    Node *node = make_node(type);
-    node->value.compound.child_count = child_count;
-    node->value.compound.children = calloc(child_count, sizeof(Node *));
-    return node;
-}
-
-Env *define(Env *env, char *name, Node *value) {
-    Env *new_binding = calloc(1, sizeof(Env));
-    new_binding->name = strdup(name);
-    new_binding->value = value;
-    new_binding->next = env;
-    return new_binding;
-}
-
-Node *lookup(Env *env, char *name) {
-    for (; env; env = env->next) {
-        if (strcmp(env->name, name) == 0) return env->value;
-    }
-    return NULL;
-}
-
-// Forward declaration
-Node *parse_expression();
-
-// Parser for content inside parentheses
-Node *parse_paren_content() {
-    Node *content = make_compound_node(LIST, 0);
-    while (gettoken() && token[0] != ')') {
-        Node *next = parse_expression();
-        if (next) {
-            content->value.compound.children = realloc(content->value.compound.children, (content->value.compound.child_count + 1) * sizeof(Node*));
-            content->value.compound.children[content->value.compound.child_count++] = next;
-        }
-    }
-    return content;
-}
-
-Node *parse_expression() {
-    if (strcmp(token, "def") == 0) {
-        Node *def_node = make_compound_node(DEF, 0);
-        
-        gettoken(); // Get the symbol to be defined
-        def_node->value.compound.children = realloc(def_node->value.compound.children, (def_node->value.compound.child_count + 1) * sizeof(Node*));
-        def_node->value.compound.children[def_node->value.compound.child_count++] = make_symbol(token);
-
-        gettoken(); // Get the next token, which should be 'args'
-        if (strcmp(token, "args") == 0) {
-            def_node->value.compound.children = realloc(def_node->value.compound.children, (def_node->value.compound.child_count + 1) * sizeof(Node*));
-            gettoken(); // consume '('
-            Node *args_list = make_compound_node(ARGS, 0);
-            while(gettoken() && token[0] != ')') {
-                args_list->value.compound.children = realloc(args_list->value.compound.children, (args_list->value.compound.child_count + 1) * sizeof(Node*));
-                args_list->value.compound.children[args_list->value.compound.child_count++] = make_symbol(token);
-            }
-            def_node->value.compound.children[def_node->value.compound.child_count++] = args_list;
-            
-            gettoken(); // get the first token of the body
-            def_node->value.compound.children = realloc(def_node->value.compound.children, (def_node->value.compound.child_count + 1) * sizeof(Node*));
-            def_node->value.compound.children[def_node->value.compound.child_count++] = parse_expression();
-
-        } else {
-            // It's a simple variable assignment
-            Node *value_node = parse_expression();
-            def_node->value.compound.children = realloc(def_node->value.compound.children, (def_node->value.compound.child_count + 1) * sizeof(Node*));
-            def_node->value.compound.children[def_node->value.compound.child_count++] = value_node;
-        }
-        return def_node;
-    } else if (strcmp(token, "if") == 0) {
-        Node *if_node = make_compound_node(IF, 3);
-        // Child 0: condition
-        gettoken();
-        if_node->value.compound.children[0] = parse_expression();
-        // Child 1: true branch
-        gettoken();
-        if_node->value.compound.children[1] = parse_expression();
-        // Child 2: false branch
-        gettoken();
-        if_node->value.compound.children[2] = parse_expression();
-        return if_node;
-    } else if (strcmp(token, "list") == 0) {
-        Node *list_node = make_compound_node(LIST, 0);
-        gettoken(); // consume '('
-        while (gettoken() && token[0] != ')') {
-            Node *next = parse_expression();
-            if (next) {
-                list_node->value.compound.children = realloc(list_node->value.compound.children, (list_node->value.compound.child_count + 1) * sizeof(Node*));
-                list_node->value.compound.children[list_node->value.compound.child_count++] = next;
-            }
-        }
-        return list_node;
-    } else if (strcmp(token, "data") == 0) {
-        Node *data_node = make_compound_node(DATA, 0);
-        gettoken(); // consume '('
-        while (gettoken() && token[0] != ')') {
-            Node *next = parse_expression();
-            if (next) {
-                data_node->value.compound.children = realloc(data_node->value.compound.children, (data_node->value.compound.child_count + 1) * sizeof(Node*));
-                data_node->value.compound.children[data_node->value.compound.child_count++] = next;
-            }
-        }
-        return data_node;
-    } else if (strcmp(token, "(") == 0) { // New check for opening parenthesis
-        return parse_paren_content();
-    } else {
-        if (peek_char() == '(') {
-            Node *call_node = make_compound_node(FUNCTION_CALL, 0);
-            call_node->value.compound.children = realloc(call_node->value.compound.children, sizeof(Node*));
-            call_node->value.compound.children[call_node->value.compound.child_count++] = make_symbol(token);
-            gettoken(); // consume '('
-            Node *args_content = parse_paren_content();
-            call_node->value.compound.children = realloc(call_node->value.compound.children, (call_node->value.compound.child_count + args_content->value.compound.child_count) * sizeof(Node*));
-            for (int i = 0; i < args_content->value.compound.child_count; i++) {
-                call_node->value.compound.children[call_node->value.compound.child_count++] = args_content->value.compound.children[i];
-            }
-            return call_node;
-        } else {
-            // Check if it's a number
-            long num = strtol(token, NULL, 10);
-            if (num != 0 || (strcmp(token, "0") == 0)) {
-                return make_number(num);
-            } else if (input_buffer[input_pos - 1] == '"') {
-                return make_string(token);
-            } else {
-                return make_symbol(token);
-            }
-        }
-    }
-}
-
-Node *eval(Node *expr, Env **env) {
-    if (!expr) return NULL;
-    switch (expr->type) {
-        case SYMBOL: {
-            Node *result = lookup(*env, expr->value.name);
-            if (!result) {
-                char error_msg[100];
-                sprintf(error_msg, "Undefined symbol '%s'", expr->value.name);
-                return make_error(error_msg);
-            }
-            return result;
-        }
-        case NUMBER:
-        case BOOLEAN:
-        case ERROR:
-        case STRING:
-        case PRIMITIVE_OP:
-        case DATA:
-            return expr;
-        case LIST: {
-            // Check if this list is a function call
-            if (expr->value.compound.child_count > 0 && 
-                (expr->value.compound.children[0]->type == SYMBOL || 
-                 expr->value.compound.children[0]->type == PRIMITIVE_OP)) {
-                // Construct a function call node and evaluate it
-                Node *call_node = make_compound_node(FUNCTION_CALL, expr->value.compound.child_count);
-                for (int i = 0; i < expr->value.compound.child_count; i++) {
-                    call_node->value.compound.children[i] = expr->value.compound.children[i];
-                }
-                return eval(call_node, env);
-            } else {
-                // It's a data list, evaluate its children
-                Node *new_list = make_compound_node(LIST, expr->value.compound.child_count);
-                for (int i = 0; i < expr->value.compound.child_count; i++) {
-                    new_list->value.compound.children[i] = eval(expr->value.compound.children[i], env);
-                    if (new_list->value.compound.children[i]->type == ERROR) {
-                        return new_list->value.compound.children[i];
-                    }
-                }
-                return new_list;
-            }
-        }
-        case FUNCTION_CALL: {
-            if (expr->value.compound.child_count == 0) return make_compound_node(LIST, 0);
-            
-            Node *op = eval(expr->value.compound.children[0], env);
-            if (op->type == ERROR) return op;
-
-            // Collect and evaluate arguments
-            Node **args = calloc(expr->value.compound.child_count - 1, sizeof(Node*));
-            for (int i = 1; i < expr->value.compound.child_count; i++) {
-                args[i-1] = eval(expr->value.compound.children[i], env);
-                if (args[i-1]->type == ERROR) {
-                    free(args);
-                    return args[i-1];
-                }
-            }
-            int arg_count = expr->value.compound.child_count - 1;
-
-            if (op->type == PRIMITIVE_OP) {
-                char *op_name = op->value.name;
-                if (strcmp(op_name, "+") == 0 || strcmp(op_name, "-") == 0 || strcmp(op_name, "*") == 0 || strcmp(op_name, "/") == 0) {
-                    if (arg_count != 2) return make_error("Arity mismatch: Expected 2 arguments for arithmetic operator");
-                    if (args[0]->type != NUMBER || args[1]->type != NUMBER) return make_error("Type error: Arguments must be numbers");
-                    long num1 = args[0]->value.number;
-                    long num2 = args[1]->value.number;
-                    if (strcmp(op_name, "+") == 0) return make_number(num1 + num2);
-                    if (strcmp(op_name, "-") == 0) return make_number(num1 - num2);
-                    if (strcmp(op_name, "*") == 0) return make_number(num1 * num2);
-                    if (strcmp(op_name, "/") == 0) {
-                        if (num2 == 0) return make_error("Division by zero");
-                        return make_number(num1 / num2);
-                    }
-                } else if (strcmp(op_name, "<") == 0 || strcmp(op_name, ">") == 0 || strcmp(op_name, "eq?") == 0) {
-                    if (arg_count != 2) return make_error("Arity mismatch: Expected 2 arguments for comparison operator");
-                    if (args[0]->type != NUMBER || args[1]->type != NUMBER) return make_error("Type error: Arguments must be numbers");
-                    long num1 = args[0]->value.number;
-                    long num2 = args[1]->value.number;
-                    if (strcmp(op_name, "<") == 0) return make_boolean(num1 < num2);
-                    if (strcmp(op_name, ">") == 0) return make_boolean(num1 > num2);
-                    if (strcmp(op_name, "eq?") == 0) return make_boolean(num1 == num2);
-                } else if (strcmp(op_name, "first") == 0) {
-                    if (arg_count != 1) return make_error("Arity mismatch: 'first' expects 1 argument");
-                    if (args[0]->type != LIST) return make_error("Type error: 'first' expects a list");
-                    if (args[0]->value.compound.child_count == 0) return make_error("Error: 'first' called on empty list");
-                    return args[0]->value.compound.children[0];
-                } else if (strcmp(op_name, "rest") == 0) {
-                    if (arg_count != 1) return make_error("Arity mismatch: 'rest' expects 1 argument");
-                    if (args[0]->type != LIST) return make_error("Type error: 'rest' expects a list");
-                    if (args[0]->value.compound.child_count == 0) return make_error("Error: 'rest' called on empty list");
-                    
-                    Node *new_list = make_compound_node(LIST, args[0]->value.compound.child_count - 1);
-                    for (int i = 1; i < args[0]->value.compound.child_count; i++) {
-                        new_list->value.compound.children[i-1] = args[0]->value.compound.children[i];
-                    }
-                    return new_list;
-                } else if (strcmp(op_name, "cons") == 0) {
-                    if (arg_count != 2) return make_error("Arity mismatch: 'cons' expects 2 arguments");
-                    Node *new_list = make_compound_node(LIST, 0);
-                    new_list->value.compound.children = realloc(new_list->value.compound.children, (new_list->value.compound.child_count + 1) * sizeof(Node*));
-                    new_list->value.compound.children[new_list->value.compound.child_count++] = args[0];
-                    if (args[1]->type == LIST) {
-                        new_list->value.compound.children = realloc(new_list->value.compound.children, (new_list->value.compound.child_count + args[1]->value.compound.child_count) * sizeof(Node*));
-                        for (int i = 0; i < args[1]->value.compound.child_count; i++) {
-                            new_list->value.compound.children[new_list->value.compound.child_count++] = args[1]->value.compound.children[i];
-                        }
-                    } else {
-                        return make_error("Type error: 'cons' second argument must be a list");
-                    }
-                    return new_list;
-                } else if (strcmp(op_name, "write") == 0) {
-                    if (arg_count != 1) return make_error("Arity mismatch: 'write' expects 1 argument");
-                    print_node(args[0]);
-                    printf("\n");
-                    return make_boolean(1); // Return a value to continue the REPL
-                } else {
-                    return make_error("Unknown primitive operator");
-                }
-            } else if (op->type == DEF) {
-                // This is a user-defined function call
-                Node *func_def_node = op;
-                Node *args_node = func_def_node->value.compound.children[1];
-                Node *body_node = func_def_node->value.compound.children[2];
-                
-                if (args_node->value.compound.child_count != arg_count) {
-                    return make_error("Arity mismatch in user-defined function");
-                }
-                
-                Env *local_env = *env;
-                // Correct scoping: Add the function itself to the local environment for recursion
-                local_env = define(local_env, func_def_node->value.compound.children[0]->value.name, func_def_node);
-
-                for (int i = 0; i < args_node->value.compound.child_count; i++) {
-                    Node *param_name = args_node->value.compound.children[i];
-                    local_env = define(local_env, param_name->value.name, args[i]);
-                }
-                return eval(body_node, &local_env);
-            }
-            return make_error("Cannot apply a non-function or undefined operator");
-        }
-        case DEF: {
-            char *name = expr->value.compound.children[0]->value.name;
-            
-            // This now handles both function and variable definitions
-            if (expr->value.compound.child_count == 3) {
-                 // It's a function definition, store the entire DEF node
-                 *env = define(*env, name, expr);
-                 return make_boolean(1); // Return a value to signify success
-            } else {
-                 // It's a simple variable assignment
-                 Node *value = expr->value.compound.children[1];
-                 Node *evaluated_value = eval(value, env);
-                 *env = define(*env, name, evaluated_value);
-                 return evaluated_value;
-            }
-        }
-        case IF: {
-            Node *condition = expr->value.compound.children[0];
-            Node *true_branch = expr->value.compound.children[1];
-            Node *false_branch = expr->value.compound.children[2];
-            
-            Node *condition_result = eval(condition, env);
-            if (condition_result->type == ERROR) return condition_result;
-            
-            if (condition_result && condition_result->type == BOOLEAN) {
-                if (condition_result->value.number != 0) {
-                    return eval(true_branch, env);
-                } else {
-                    return eval(false_branch, env);
-                }
-            } else {
-                 return make_error("'if' condition must be a boolean");
-            }
-        }
-        default:
-            return make_error("Cannot evaluate expression of this type");
-    }
-}
-
-void print_node(Node *node) {
-    if (!node) {
-        printf("nil");
-        return;
-    }
-    switch(node->type) {
-        case NUMBER:
-            printf("%ld", node->value.number);
-            break;
-        case BOOLEAN:
-            if (node->value.number == 1) printf("true"); else printf("false");
-            break;
-        case SYMBOL:
-        case PRIMITIVE_OP:
-            printf("%s", node->value.name);
-            break;
-        case STRING:
-            printf("\"%s\"", node->value.string);
-            break;
-        case ERROR:
-            printf("Error: %s", node->value.name);
-            break;
-        case LIST:
-            printf("list(");
-            for (int i = 0; i < node->value.compound.child_count; i++) {
-                print_node(node->value.compound.children[i]);
-                if (i < node->value.compound.child_count - 1) {
-                    printf(" ");
-                }
-            }
-            printf(")");
-            break;
-        case FUNCTION_CALL:
-            printf("func_call(");
-            for (int i = 0; i < node->value.compound.child_count; i++) {
-                print_node(node->value.compound.children[i]);
-                if (i < node->value.compound.child_count - 1) {
-                    printf(" ");
-                }
-            }
-            printf(")");
-            break;
-        case DATA:
-            printf("data(");
-            for (int i = 0; i < node->value.compound.child_count; i++) {
-                print_node(node->value.compound.children[i]);
-                if (i < node->value.compound.child_count - 1) {
-                    printf(" ");
-                }
-            }
-            printf(")");
-            break;
-        default:
-            printf("?");
-    }
-}
-
-/* --- Main Loop --- */
-
-int main() {
-    // Set up initial environment with primitives
-    Env *env = NULL;
-    env = define(env, "+", make_primitive_op("+"));
-    env = define(env, "-", make_primitive_op("-"));
-    env = define(env, "*", make_primitive_op("*"));
-    env = define(env, "/", make_primitive_op("/"));
-    env = define(env, "<", make_primitive_op("<"));
-    env = define(env, ">", make_primitive_op(">"));
-    env = define(env, "eq?", make_primitive_op("eq?"));
-    env = define(env, "write", make_primitive_op("write"));
-    env = define(env, "true", make_boolean(1));
-    env = define(env, "false", make_boolean(0));
-    env = define(env, "first", make_primitive_op("first"));
-    env = define(env, "rest", make_primitive_op("rest"));
-    env = define(env, "cons", make_primitive_op("cons"));
-    
-    printf("ListScript ready.\n");
-    while (1) {
-        printf("-> ");
-        if (!read_line()) break;
-        if (!gettoken()) continue;
-        
-        if (strcmp(token, "bye") == 0) {
-            printf("Bye!\n");
-            break;
-        }
-
-        Node *parsed_exp = parse_expression();
-        if (parsed_exp) {
-            Node *result = eval(parsed_exp, &env);
-            if (result && result->type != ERROR) {
-                 print_node(result);
-                 printf("\n");
-            } else if (result) {
-                print_node(result);
-                printf("\n");
-            }
-        } else {
-            printf("Parse error.\n");
-        }
-    }
-    return 0;
-}
\ No newline at end of file
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "listscript.h"
+
+#define debug(m,e) printf("%s:%d: %s:",__FILE__,__LINE__,m); print_obj(e,1); puts("");
+
+/* --- Data Structures --- */
+
+// Node types for the AST
+typedef enum {
+    DEF,
+    ARGS,
+    LIST,
+    DATA,
+    IF,
+    SYMBOL,
+    NUMBER,
+    PRIMITIVE_OP,
+    BOOLEAN,
+    ERROR,
+    FUNCTION_CALL,
+    STRING,
+    LOCAL_REF,
+    LIST_BUFFER,
+    VECTOR,
+    SEQ,
+    CLOSURE,
+    NODE_TYPE_COUNT
+} NodeType;
+
+// Kinds of lazy sequence
+typedef enum {
+    SEQ_RANGE,
+    SEQ_MAP,
+    SEQ_FILTER,
+    SEQ_TAKE
+} SeqKind;
+
+// Primitive operations, indexed by opcode
+typedef enum {
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_LT,
+    OP_GT,
+    OP_EQ,
+    OP_ERROR_P,
+    OP_WRITE,
+    OP_FIRST,
+    OP_REST,
+    OP_CONS,
+    OP_STRLEN,
+    OP_CONCAT,
+    OP_SUBSTR,
+    OP_SPLIT,
+    OP_VECTOR,
+    OP_VSUM,
+    OP_VDOT,
+    OP_VMAP_ADD,
+    OP_VCMP,
+    OP_RANGE,
+    OP_MAP,
+    OP_FILTER,
+    OP_TAKE,
+    OP_PMAP,
+    OP_PFILTER,
+    OP_PREDUCE,
+    OP_COUNT,
+    OP_HOST // A primitive registered through the embedding API, outside the table
+} Opcode;
+
+// Errors, indexed by code. Each code with a fixed message has one preallocated
+// node; the others allocate a node per error.
+typedef enum {
+    ERR_MESSAGE, // A formatted message, owned by the node
+    // The message is formatted from a detail, the name of a symbol or primitive,
+    // when it is first read
+    ERR_UNDEFINED_SYMBOL,
+    ERR_UNDEFINED_FUNCTION,
+    ERR_CONSTANT,
+    ERR_VECTOR_OPERAND,
+    ERR_VECTOR_LENGTH,
+    ERR_PARALLEL_FUNCTION,
+    ERR_PARALLEL_LIST,
+    ERR_SEQUENCE_FUNCTION,
+    ERR_SEQUENCE_SOURCE,
+    ERR_UNBOUND_CAPTURE,
+    ERR_DETAILED, // Codes below have fixed messages
+    ERR_OUT_OF_MEMORY,
+    ERR_STACK_OVERFLOW,
+    ERR_RECURSION_DEPTH,
+    ERR_NOT_A_FUNCTION,
+    ERR_BAD_EXPRESSION,
+    ERR_IF_CONDITION,
+    ERR_ARITY,
+    ERR_NESTED_RUN,
+    ERR_ARITHMETIC_ARITY,
+    ERR_COMPARISON_ARITY,
+    ERR_NUMBER_TYPE,
+    ERR_DIVISION_BY_ZERO,
+    ERR_ERROR_P_ARITY,
+    ERR_WRITE_ARITY,
+    ERR_FIRST_ARITY,
+    ERR_FIRST_TYPE,
+    ERR_FIRST_EMPTY,
+    ERR_FIRST_EMPTY_VECTOR,
+    ERR_FIRST_EMPTY_SEQUENCE,
+    ERR_REST_ARITY,
+    ERR_REST_TYPE,
+    ERR_REST_EMPTY,
+    ERR_REST_EMPTY_VECTOR,
+    ERR_REST_EMPTY_SEQUENCE,
+    ERR_CONS_ARITY,
+    ERR_CONS_TYPE,
+    ERR_STRLEN_ARITY,
+    ERR_STRLEN_TYPE,
+    ERR_CONCAT_TYPE,
+    ERR_SUBSTR_ARITY,
+    ERR_SUBSTR_TYPE,
+    ERR_SUBSTR_RANGE_TYPE,
+    ERR_SUBSTR_RANGE,
+    ERR_SPLIT_ARITY,
+    ERR_SPLIT_TYPE,
+    ERR_SPLIT_SEPARATOR,
+    ERR_VECTOR_TYPE,
+    ERR_VSUM_ARITY,
+    ERR_VSUM_TYPE,
+    ERR_VDOT_ARITY,
+    ERR_VDOT_TYPE,
+    ERR_VDOT_LENGTH,
+    ERR_VMAP_ADD_ARITY,
+    ERR_VCMP_ARITY,
+    ERR_VCMP_OPERATOR,
+    ERR_RANGE_ARITY,
+    ERR_RANGE_TYPE,
+    ERR_RANGE_STEP,
+    ERR_MAP_ARITY,
+    ERR_FILTER_ARITY,
+    ERR_FILTER_RESULT,
+    ERR_TAKE_ARITY,
+    ERR_TAKE_COUNT,
+    ERR_PMAP_ARITY,
+    ERR_PFILTER_ARITY,
+    ERR_PFILTER_RESULT,
+    ERR_PREDUCE_ARITY,
+    ERR_COUNT
+} ErrorCode;
+
+// Primitives receive their already-evaluated arguments
+typedef struct Node *(*PrimitiveFn)(struct Node **args, int arg_count);
+
+// Node flags
+#define NODE_ARENA      0x01 // Allocated from an arena, reclaimed when it resets
+#define NODE_MARK       0x02 // Reached during the current collection
+#define NODE_FREE       0x04 // On the heap's free list
+#define NODE_PERSISTENT 0x08 // Heap value that reaches no arena nodes
+#define NODE_STATIC     0x10 // Preallocated constant, never collected
+#define NODE_MEMO       0x20 // A top-level function declared with defmemo
+#define NODE_CONST      0x40 // A top-level definition declared with defconst
+#define NODE_LATE       0x80 // A local def whose slot closures made before it ran captured
+
+// A Node represents a single element in our program's AST.
+typedef struct Node {
+    NodeType type;
+    unsigned char flags;
+    union {
+        // For SYMBOL and PRIMITIVE_OP nodes (SYMBOL names are interned)
+        char *name;
+        // For NUMBER and BOOLEAN nodes
+        long number;
+        // For LIST, ARGS, DEF, DATA, IF, FUNCTION_CALL nodes
+        struct {
+            struct Node **children;
+            int child_count;
+            // For function DEF nodes: slots in a call frame, the enclosing
+            // function's locals that the body uses (an ARGS node of
+            // LOCAL_REFs into that function's frame, or NULL if none), and
+            // the body's bytecode once it has been compiled
+            union {
+                int frame_size;
+                // For calls folded against built-ins: one bit per opcode
+                // of the pure built-ins their folded value was computed with
+                unsigned fold_deps;
+            };
+            union {
+                struct Node *captures;
+                // For LIST nodes that are slices of another node's
+                // children: the LIST or LIST_BUFFER that owns them
+                struct Node *owner;
+            };
+            union {
+                struct Code *code;
+                // For calls folded against built-ins, which may be redefined:
+                // their value, used while none of fold_deps is rebound
+                struct Node *folded;
+            };
+        } compound;
+        // For LIST_BUFFER nodes: storage shared by list slices. Elements
+        // are filled from the end down, so cons can prepend in place.
+        struct {
+            struct Node **items;
+            int capacity;
+            int start;
+        } buffer;
+        // For STRING nodes: `length` bytes at `chars`. A flat string owns its
+        // chars, NUL-terminated. A view (from substr or split) points into
+        // the chars of the flat string `base`. A rope (from concat) has no
+        // chars until it is first read, only its halves `base` and `right`.
+        struct {
+            char *chars;
+            int length;
+            int depth; // Of a rope; 0 for flat strings and views
+            struct Node *base;
+            struct Node *right;
+        } str;
+        // For VECTOR nodes: `length` packed numbers. A vector made by rest
+        // shares the items of `owner`, the vector that allocated them.
+        struct {
+            long *items;
+            int length;
+            struct Node *owner;
+        } vector;
+        // For SEQ nodes: a lazy sequence. A range holds its next value, the
+        // bound it stops before, and its step. The others draw from `source`
+        // (a SEQ, LIST or VECTOR) and keep their first element in `head`
+        // once it has been computed.
+        struct {
+            union {
+                struct {
+                    struct Node *source;
+                    union {
+                        struct Node *fn; // SEQ_MAP, SEQ_FILTER
+                        long count;      // SEQ_TAKE: elements left
+                    };
+                    struct Node *head;
+                };
+                struct {
+                    long next;
+                    long end;
+                    long step;
+                };
+            };
+            SeqKind kind;
+        } seq;
+        // For ERROR nodes: the message, or NULL until one formatted from
+        // `detail` is first read
+        struct {
+            char *message;
+            ErrorCode code;
+            char *detail;
+        } error;
+        // For PRIMITIVE_OP nodes
+        struct {
+            char *name;
+            Opcode opcode;
+            union {
+                PrimitiveFn fn;
+                ls_primitive host; // For OP_HOST
+            };
+        } prim;
+        // For CLOSURE nodes: a nested function DEF and the values its
+        // captures had when the DEF ran
+        struct {
+            struct Node *def;
+            struct Node **values;
+            int count;
+        } closure;
+        // For LOCAL_REF nodes: a resolved variable's slot in the current frame
+        struct {
+            char *name;
+            int slot;
+            int captured; // The slot holds a value copied from an enclosing function
+        } ref;
+    } value;
+} Node;
+
+// Forward declaration to fix the compiler warning
+void print_node(Node *node);
+
+// The Environment holds the top-level (global) bindings in an open-addressing
+// hash table keyed by interned name pointer. Locals live in Frames.
+typedef struct Binding {
+    char *name; // NULL for an empty slot
+    struct Node *value;
+    int constant; // Never rebound, so the folder may inline the value
+} Binding;
+
+typedef struct Env {
+    Binding *slots;
+    int capacity; // A power of two
+    int count;
+    intptr_t epoch; // Bumped when a global is rebound, invalidating the VM's inline caches
+    unsigned rebound_ops; // One bit per opcode of a pure built-in whose name was rebound, retiring calls folded with it
+} Env;
+
+// A Frame holds the locals of one user-defined function call. Slot 0 is the
+// function itself, followed by its parameters, any local defs, and the
+// values a closure captured. `caller` is the frame that made the call.
+typedef struct Frame {
+    struct Frame *caller;
+    int count;
+    int capacity;
+    struct Node *slots[];
+} Frame;
+
+// Region allocator blocks, defined with the arenas
+typedef struct Arena {
+    struct ArenaBlock *head;
+} Arena;
+
+typedef struct GcStats {
+    long collections;
+    long nodes_allocated;
+    long nodes_freed;
+    long live_nodes;
+    size_t heap_bytes;      // Live node storage plus owned strings and child arrays
+    size_t peak_heap_bytes;
+    double total_pause_ms;
+    double max_pause_ms;
+} GcStats;
+
+// A function's place in the profiler's call tree
+typedef struct ProfileNode {
+    struct ProfileEntry *entry;
+    struct ProfileNode *parent;
+    struct ProfileNode *child;
+    struct ProfileNode *sibling;
+    long calls;
+    uint64_t self_ns;
+} ProfileNode;
+
+#define PROFILE_BUCKETS 1024
+
+// One interpreter instance: its input and tokenizer, symbols, parse arena,
+// collected heap, globals, memo cache and profile. Instances share nothing,
+// so several can run at once, one per thread. The per-thread evaluation
+// state (frame and eval stacks, the stack limit) belongs to the thread.
+typedef struct Interp {
+    // Input buffer for the tokenizer. It holds a whole script with --run, or
+    // the lines of one REPL expression otherwise, and grows as needed.
+    char *input_buffer;
+    size_t input_capacity;
+    size_t input_pos;
+    // The current token is a slice of the input buffer, not a copy
+    const char *token;
+    size_t token_length;
+    int token_quoted; // A closed "..." string; token excludes the quotes
+
+    struct Symbol **symbol_table;
+    int symbol_buckets;
+    int symbol_count;
+
+    Arena ast_arena;
+
+    struct HeapPage *heap_pages;
+    struct Node *free_nodes;
+    GcStats gc_stats;
+    size_t gc_threshold;
+    size_t heap_limit; // 0 means unlimited
+    int gc_requested;
+    struct Node **mark_stack;
+    int mark_count;
+    int mark_capacity;
+
+    Env global_env;
+    int use_tree_walker;
+
+    long memo_limit;
+    struct MemoEntry **memo_table;
+    long memo_buckets;
+    long memo_count;
+    struct MemoEntry *memo_newest;
+    struct MemoEntry *memo_oldest;
+
+    const char *profile_stacks_path;
+    struct ProfileEntry *profile_table[PROFILE_BUCKETS];
+    int profile_functions;
+    ProfileNode profile_root;
+    struct ProfileCall *profile_stack;
+    int profile_sp;
+    int profile_capacity;
+
+    struct Script *scripts; // Loaded through ls_compile; their forms are roots
+    struct ImageBlock *images; // Nodes loaded from images, kept until the instance is freed
+} Interp;
+
+// The nodes of a loaded image, in one allocation. They are NODE_STATIC, so
+// the collector neither marks nor frees them: they only reach other image
+// nodes and the static constants.
+typedef struct ImageBlock {
+    struct ImageBlock *next;
+    struct Node *nodes;
+    uint32_t node_count; // Allocated so far
+    struct Node **children; // Shared by the compound nodes' child arrays
+    uint32_t child_count;
+    char *strings;
+} ImageBlock;
+
+// A script parsed once through the embedding API, kept with its top-level
+// forms and their bytecode so it can be run again
+typedef struct Script {
+    struct Script *next;
+    Interp *interp;
+    struct Node **forms; // Resolved, on the heap
+    struct Code **code; // Per form, compiled on first run
+    int count;
+    const char *call_name; // ls_call's last name, as passed and interned
+    char *call_symbol;
+} Script;
+
+// The instance the current thread is running. Entry points such as
+// eval_form take an Interp and bind it here for the code below them.
+static _Thread_local Interp *interp = NULL;
+
+/* --- Output --- */
+
+// Everything the interpreter prints to stdout is serialized into a growable
+// per-thread record, and whole records are appended to one shared stream.
+// The stream is written in large blocks, with writev when a record does not
+// fit, so printing costs a memcpy per atom instead of a stdio call. With
+// --async-output a writer thread does the writes while the interpreter fills
+// a second buffer. Records from different threads never interleave.
+#define OUT_FLUSH_BYTES (64 * 1024)
+
+typedef struct OutBuf {
+    char *data;
+    size_t used;
+    size_t capacity;
+} OutBuf;
+
+static _Thread_local OutBuf out_record;
+static OutBuf out_stream;  // Guarded by out_lock
+static OutBuf out_pending; // Handed to the writer thread; empty when it is idle
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t out_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t out_idle = PTHREAD_COND_INITIALIZER;
+static int out_async = 0;
+static int out_line_flush = 0; // Flush before reading input, as stdio does on a terminal
+
+static void out_reserve(OutBuf *buf, size_t needed) {
+    if (buf->used + needed <= buf->capacity) return;
+    size_t capacity = buf->capacity ? buf->capacity : 256;
+    while (capacity < buf->used + needed) capacity *= 2;
+    buf->data = realloc(buf->data, capacity);
+    if (!buf->data) {
+        fprintf(stderr, "Out of memory writing output\n");
+        exit(1);
+    }
+    buf->capacity = capacity;
+}
+
+void out_write(const char *bytes, size_t length) {
+    out_reserve(&out_record, length);
+    memcpy(out_record.data + out_record.used, bytes, length);
+    out_record.used += length;
+}
+
+void out_char(char c) {
+    out_reserve(&out_record, 1);
+    out_record.data[out_record.used++] = c;
+}
+
+void out_cstr(const char *string) {
+    out_write(string, strlen(string));
+}
+
+void out_long(long number) {
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    unsigned long n = number < 0 ? -(unsigned long)number : (unsigned long)number;
+    do {
+        *--p = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    if (number < 0) *--p = '-';
+    out_write(p, digits + sizeof(digits) - p);
+}
+
+void out_printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (length < 0) return;
+    out_reserve(&out_record, length + 1);
+    va_start(args, format);
+    vsnprintf(out_record.data + out_record.used, length + 1, format, args);
+    va_end(args);
+    out_record.used += length;
+}
+
+// Writes the iovecs to stdout in full. Anything a host left in stdio goes first.
+static void write_out(struct iovec *iov, int count) {
+    fflush(stdout);
+    while (count > 0) {
+        ssize_t written = writev(STDOUT_FILENO, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return; // Output is gone, as with a closed pipe
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+static void *out_writer(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&out_lock);
+    for (;;) {
+        while (!out_pending.used) pthread_cond_wait(&out_wake, &out_lock);
+        struct iovec iov = { out_pending.data, out_pending.used };
+        pthread_mutex_unlock(&out_lock);
+        write_out(&iov, 1);
+        pthread_mutex_lock(&out_lock);
+        out_pending.used = 0;
+        pthread_cond_broadcast(&out_idle);
+    }
+    return NULL;
+}
+
+// Starts the writer thread. Returns 0 if it cannot, leaving writes synchronous.
+int out_start_async() {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, out_writer, NULL) != 0) return 0;
+    pthread_detach(thread);
+    out_async = 1;
+    return 1;
+}
+
+// Writes the stream, followed by `extra` bytes that are not in it, or hands
+// the stream to the writer thread. out_lock is held.
+static void out_emit(const char *extra, size_t extra_length) {
+    if (!out_async) {
+        struct iovec iov[2] = { { out_stream.data, out_stream.used }, { (char *)extra, extra_length } };
+        write_out(iov, extra_length ? 2 : 1);
+        out_stream.used = 0;
+        return;
+    }
+    if (extra_length) {
+        out_reserve(&out_stream, extra_length);
+        memcpy(out_stream.data + out_stream.used, extra, extra_length);
+        out_stream.used += extra_length;
+    }
+    while (out_pending.used) pthread_cond_wait(&out_idle, &out_lock);
+    OutBuf full = out_stream;
+    out_stream = out_pending;
+    out_pending = full;
+    pthread_cond_signal(&out_wake);
+}
+
+// Ends this thread's record, appending it to the stream, which is written
+// once it holds OUT_FLUSH_BYTES
+void out_end() {
+    if (!out_record.used) return;
+    pthread_mutex_lock(&out_lock);
+    if (out_stream.used + out_record.used < OUT_FLUSH_BYTES) {
+        out_reserve(&out_stream, out_record.used);
+        memcpy(out_stream.data + out_stream.used, out_record.data, out_record.used);
+        out_stream.used += out_record.used;
+    } else {
+        // A record too big for the stream is written from where it is
+        out_emit(out_record.data, out_record.used);
+    }
+    pthread_mutex_unlock(&out_lock);
+    out_record.used = 0;
+}
+
+// Writes everything printed so far, waiting for the writer thread
+void out_flush() {
+    out_end();
+    pthread_mutex_lock(&out_lock);
+    if (out_stream.used) out_emit(NULL, 0);
+    while (out_pending.used) pthread_cond_wait(&out_idle, &out_lock);
+    pthread_mutex_unlock(&out_lock);
+}
+
+// Prints a prompt before reading input
+void out_prompt(const char *prompt) {
+    out_cstr(prompt);
+    if (out_line_flush) out_flush();
+    else out_end();
+}
+
+/* --- Core Functions --- */
+
+// Input buffers grow in steps of this many bytes
+#define INPUT_CHUNK 65536
+// Character classes for the tokenizer
+enum { CHAR_SPACE = 1, CHAR_PAREN = 2, CHAR_COMMENT = 4, CHAR_QUOTE = 8, CHAR_END = 16 };
+#define CHAR_BLANK (CHAR_SPACE | CHAR_COMMENT)
+#define CHAR_DELIMITER (CHAR_SPACE | CHAR_PAREN | CHAR_END)
+static const unsigned char char_class[256] = {
+    ['\0'] = CHAR_END, [' '] = CHAR_SPACE, ['\n'] = CHAR_SPACE, ['\t'] = CHAR_SPACE,
+    ['('] = CHAR_PAREN, [')'] = CHAR_PAREN, [';'] = CHAR_COMMENT, ['"'] = CHAR_QUOTE,
+};
+#define CHAR_IS(x, class) (char_class[(unsigned char)(x)] & (class))
+
+// Tokenizer helpers
+int is_space(char x) { return CHAR_IS(x, CHAR_SPACE); }
+int is_parens(char x) { return CHAR_IS(x, CHAR_PAREN); }
+int is_alpha(char x) { return (x >= 'a' && x <= 'z') || (x >= 'A' && x <= 'Z'); }
+int is_digit(char x) { return x >= '0' && x <= '9'; }
+
+// Returns 1 if the current token is the unquoted word
+static inline int token_is(const char *word) {
+    return !interp->token_quoted && interp->token_length == strlen(word) && memcmp(interp->token, word, interp->token_length) == 0;
+}
+
+// REPL commands followed by a file name
+static int command_takes_path() {
+    return token_is(":save") || token_is(":restore");
+}
+
+// Makes room for at least `needed` bytes in the input buffer
+static void reserve_input(size_t needed) {
+    if (needed <= interp->input_capacity) return;
+    size_t capacity = interp->input_capacity ? interp->input_capacity : INPUT_CHUNK;
+    while (capacity < needed) capacity *= 2;
+    interp->input_buffer = realloc(interp->input_buffer, capacity);
+    if (!interp->input_buffer) {
+        fprintf(stderr, "Out of memory reading input\n");
+        exit(1);
+    }
+    interp->input_capacity = capacity;
+}
+
+// Parenthesis count carried across the lines of one expression, so each
+// line is scanned once however long the expression grows
+typedef struct {
+    int depth;
+    int in_string;
+} ParenScan;
+
+// Scans the next complete lines of an expression, skipping strings and
+// comments, and returns the number of parentheses still open
+static int scan_parens(ParenScan *scan, const char *text) {
+    for (const char *p = text; *p; p++) {
+        if (scan->in_string) {
+            if (*p == '"') scan->in_string = 0;
+        } else if (*p == ';') {
+            while (*p && *p != '\n') p++;
+            if (!*p) break;
+        } else if (*p == '"') {
+            scan->in_string = 1;
+        } else if (*p == '(') {
+            scan->depth++;
+        } else if (*p == ')') {
+            scan->depth--;
+        }
+    }
+    return scan->depth;
+}
+
+// Reads one expression from stdin into the buffer, continuing onto further
+// lines while its parentheses are unbalanced
+int read_line() {
+    size_t length = 0, scanned = 0;
+    ParenScan scan = {0, 0};
+    reserve_input(INPUT_CHUNK);
+    interp->input_buffer[0] = '\0';
+    for (;;) {
+        if (interp->input_capacity - length < 2) reserve_input(interp->input_capacity * 2);
+        if (!fgets(interp->input_buffer + length, interp->input_capacity - length, stdin)) break;
+        length += strlen(interp->input_buffer + length);
+        if (interp->input_buffer[length - 1] != '\n') continue; // Line longer than the buffer
+        int depth = scan_parens(&scan, interp->input_buffer + scanned);
+        scanned = length;
+        if (depth <= 0) break;
+        out_prompt("... ");
+    }
+    interp->input_pos = 0;
+    return length > 0;
+}
+
+// Reads an entire file into the buffer in blocks
+int read_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return 0;
+    size_t length = 0, count;
+    do {
+        reserve_input(length + INPUT_CHUNK + 1);
+        count = fread(interp->input_buffer + length, 1, INPUT_CHUNK, file);
+        length += count;
+    } while (count == INPUT_CHUNK);
+    int ok = !ferror(file);
+    fclose(file);
+    interp->input_buffer[length] = '\0';
+    interp->input_pos = 0;
+    return ok;
+}
+
+// Skips a run of whitespace and comments
+static const char *skip_blank(const char *p) {
+    while (CHAR_IS(*p, CHAR_BLANK)) {
+        while (CHAR_IS(*p, CHAR_SPACE)) p++;
+        if (*p == ';') p += strcspn(p, "\n");
+    }
+    return p;
+}
+
+char peek_char() {
+    return *skip_blank(interp->input_buffer + interp->input_pos);
+}
+
+// Gets the next token from the buffer
+int gettoken() {
+    const char *p = skip_blank(interp->input_buffer + interp->input_pos);
+    interp->token_quoted = 0;
+    if (*p == '\0') {
+        interp->input_pos = p - interp->input_buffer;
+        return 0;
+    }
+
+    if (*p == '"') {
+        interp->token = ++p; // Skip the opening quote
+        p += strcspn(p, "\"");
+        interp->token_length = p - interp->token;
+        if (*p == '"') {
+            interp->token_quoted = 1;
+            p++; // Consume the closing quote
+        }
+    } else if (CHAR_IS(*p, CHAR_PAREN)) {
+        interp->token = p++;
+        interp->token_length = 1;
+    } else {
+        interp->token = p;
+        while (!CHAR_IS(*p, CHAR_DELIMITER)) p++;
+        interp->token_length = p - interp->token;
+    }
+    interp->input_pos = p - interp->input_buffer;
+    return 1;
+}
+
+/* --- Symbol Table --- */
+
+// Every symbol name is interned once, so names can be compared by pointer.
+typedef struct Symbol {
+    struct Symbol *next;
+    unsigned long hash;
+    char name[];
+} Symbol;
+
+unsigned long hash_name(const char *name, size_t length) {
+    unsigned long h = 5381;
+    while (length--) h = h * 33 + (unsigned char)*name++;
+    return h;
+}
+
+// Interns the first `length` bytes of name, which need not be NUL-terminated
+char *intern_n(const char *name, size_t length) {
+    unsigned long h = hash_name(name, length);
+    if (interp->symbol_buckets) {
+        for (Symbol *sym = interp->symbol_table[h & (interp->symbol_buckets - 1)]; sym; sym = sym->next) {
+            if (sym->hash == h && memcmp(sym->name, name, length) == 0 && sym->name[length] == '\0') return sym->name;
+        }
+    }
+    if (interp->symbol_count >= interp->symbol_buckets) {
+        // Grow and rehash once the table is full
+        int new_buckets = interp->symbol_buckets ? interp->symbol_buckets * 2 : 256;
+        Symbol **new_table = calloc(new_buckets, sizeof(Symbol *));
+        for (int i = 0; i < interp->symbol_buckets; i++) {
+            Symbol *sym = interp->symbol_table[i];
+            while (sym) {
+                Symbol *next = sym->next;
+                sym->next = new_table[sym->hash & (new_buckets - 1)];
+                new_table[sym->hash & (new_buckets - 1)] = sym;
+                sym = next;
+            }
+        }
+        free(interp->symbol_table);
+        interp->symbol_table = new_table;
+        interp->symbol_buckets = new_buckets;
+    }
+    Symbol *sym = malloc(sizeof(Symbol) + length + 1);
+    memcpy(sym->name, name, length);
+    sym->name[length] = '\0';
+    sym->hash = h;
+    sym->next = interp->symbol_table[h & (interp->symbol_buckets - 1)];
+    interp->symbol_table[h & (interp->symbol_buckets - 1)] = sym;
+    interp->symbol_count++;
+    return sym->name;
+}
+
+char *intern(const char *name) {
+    return intern_n(name, strlen(name));
+}
+
+/* --- Arenas --- */
+
+// A region allocator: allocations are bumped out of large blocks and are
+// all released together by arena_reset. Each REPL line parses into
+// ast_arena; values that outlive the line (top-level definitions) are copied
+// out to the heap by persist().
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+// Where node allocations currently go; NULL means the collected heap. Each
+// pmap worker thread points this at an arena of its own.
+static _Thread_local Arena *alloc_arena = NULL;
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    ArenaBlock *block = arena->head;
+    if (!block || block->used + size > block->size) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + block_size);
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena->head;
+        arena->head = block;
+    }
+    void *ptr = block->data + block->used;
+    block->used += size;
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+// Releases everything but the most recent block, which is kept for reuse
+void arena_reset(Arena *arena) {
+    if (!arena->head) return;
+    ArenaBlock *block = arena->head->next;
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head->next = NULL;
+    arena->head->used = 0;
+}
+
+// Call frames live on a stack of chunks. A frame is pushed when a call
+// starts; when the call returns, everything above its caller's frame is popped.
+#define FRAME_CHUNK_SIZE (256 * 1024)
+
+typedef struct FrameChunk {
+    struct FrameChunk *prev;
+    struct FrameChunk *next; // Kept after popping for reuse
+    size_t size;
+    size_t used;
+    char data[];
+} FrameChunk;
+
+static _Thread_local FrameChunk *frame_chunk = NULL;
+
+void *frame_push(size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    if (!frame_chunk || frame_chunk->used + size > frame_chunk->size) {
+        FrameChunk *next = frame_chunk ? frame_chunk->next : NULL;
+        if (!next || next->size < size) {
+            // The cached chunks are too small for this frame
+            while (next) {
+                FrameChunk *after = next->next;
+                free(next);
+                next = after;
+            }
+            size_t chunk_size = size > FRAME_CHUNK_SIZE ? size : FRAME_CHUNK_SIZE;
+            next = malloc(sizeof(FrameChunk) + chunk_size);
+            next->size = chunk_size;
+            next->prev = frame_chunk;
+            next->next = NULL;
+            if (frame_chunk) frame_chunk->next = next;
+        }
+        next->used = 0;
+        frame_chunk = next;
+    }
+    void *ptr = frame_chunk->data + frame_chunk->used;
+    frame_chunk->used += size;
+    return ptr;
+}
+
+// Pops every frame at or above `end`, an address on the stack; NULL pops
+// the whole stack
+void frame_pop_to(char *end) {
+    if (!frame_chunk) return;
+    while (frame_chunk->prev && !(end >= frame_chunk->data && end <= frame_chunk->data + frame_chunk->size)) {
+        frame_chunk = frame_chunk->prev;
+    }
+    frame_chunk->used = end ? (size_t)(end - frame_chunk->data) : 0;
+}
+
+// Pops the whole stack and frees all but the first chunk
+void frame_reset() {
+    frame_pop_to(NULL);
+    if (!frame_chunk) return;
+    FrameChunk *chunk = frame_chunk->next;
+    while (chunk) {
+        FrameChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    frame_chunk->next = NULL;
+}
+
+/* --- Profiler --- */
+
+// With --profile, every call of a user-defined function or primitive is
+// timed. Calls are aggregated per function name and into a call tree, which
+// --profile-stacks writes out as collapsed stacks for flamegraph tools.
+typedef struct ProfileEntry {
+    struct ProfileEntry *next;
+    const char *name; // Interned
+    long calls;
+    long allocations; // Nodes allocated while this function was innermost
+    uint64_t inclusive_ns; // Outermost activations only, so recursion is not counted twice
+    uint64_t self_ns;
+    int active;
+} ProfileEntry;
+
+// One running call. `frame` is the callee's frame, NULL for a primitive.
+typedef struct ProfileCall {
+    ProfileNode *node;
+    void *frame;
+    uint64_t start;
+    uint64_t child_ns;
+} ProfileCall;
+
+static _Thread_local int profiling = 0; // Never set in pmap workers
+
+static inline uint64_t profile_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+ProfileEntry *profile_entry(const char *name) {
+    ProfileEntry **bucket = &interp->profile_table[((uintptr_t)name >> 3) & (PROFILE_BUCKETS - 1)];
+    for (ProfileEntry *entry = *bucket; entry; entry = entry->next) {
+        if (entry->name == name) return entry;
+    }
+    ProfileEntry *entry = calloc(1, sizeof(ProfileEntry));
+    entry->name = name;
+    entry->next = *bucket;
+    *bucket = entry;
+    interp->profile_functions++;
+    return entry;
+}
+
+void profile_enter(const char *name, void *frame) {
+    ProfileEntry *entry = profile_entry(name);
+    entry->calls++;
+    entry->active++;
+    ProfileNode *parent = interp->profile_sp ? interp->profile_stack[interp->profile_sp - 1].node : &interp->profile_root;
+    ProfileNode *node = parent->child;
+    while (node && node->entry != entry) node = node->sibling;
+    if (!node) {
+        node = calloc(1, sizeof(ProfileNode));
+        node->entry = entry;
+        node->parent = parent;
+        node->sibling = parent->child;
+        parent->child = node;
+    }
+    node->calls++;
+    if (interp->profile_sp == interp->profile_capacity) {
+        interp->profile_capacity = interp->profile_capacity ? interp->profile_capacity * 2 : 256;
+        interp->profile_stack = realloc(interp->profile_stack, interp->profile_capacity * sizeof(ProfileCall));
+    }
+    interp->profile_stack[interp->profile_sp++] = (ProfileCall){ node, frame, profile_now(), 0 };
+}
+
+void profile_exit() {
+    ProfileCall *call = &interp->profile_stack[--interp->profile_sp];
+    uint64_t elapsed = profile_now() - call->start;
+    uint64_t self = elapsed - call->child_ns;
+    ProfileEntry *entry = call->node->entry;
+    call->node->self_ns += self;
+    entry->self_ns += self;
+    if (--entry->active == 0) entry->inclusive_ns += elapsed;
+    if (interp->profile_sp) interp->profile_stack[interp->profile_sp - 1].child_ns += elapsed;
+}
+
+// Ends every call made since `frame`'s function became innermost
+void profile_unwind(void *frame) {
+    while (interp->profile_sp && interp->profile_stack[interp->profile_sp - 1].frame != frame) profile_exit();
+}
+
+static inline void profile_allocation() {
+    if (interp->profile_sp) interp->profile_stack[interp->profile_sp - 1].node->entry->allocations++;
+}
+
+int compare_profile_entries(const void *a, const void *b) {
+    uint64_t x = (*(ProfileEntry **)a)->self_ns, y = (*(ProfileEntry **)b)->self_ns;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void write_profile_stacks(FILE *out, ProfileNode *node, char *path, size_t length) {
+    for (ProfileNode *child = node->child; child; child = child->sibling) {
+        size_t name_length = strlen(child->entry->name);
+        char *child_path = malloc(length + name_length + 2);
+        memcpy(child_path, path, length);
+        child_path[length] = ';';
+        memcpy(child_path + length + 1, child->entry->name, name_length + 1);
+        // Collapsed stack weights are self time in microseconds
+        if (child->self_ns >= 1000) fprintf(out, "%s %llu\n", child_path, (unsigned long long)(child->self_ns / 1000));
+        write_profile_stacks(out, child, child_path, length + name_length + 1);
+        free(child_path);
+    }
+}
+
+// Prints the per-function report, sorted by self time, to stderr
+void profile_report() {
+    out_flush(); // The program's output goes first
+    profile_unwind(NULL);
+    ProfileEntry **entries = malloc((interp->profile_functions + 1) * sizeof(ProfileEntry *));
+    int count = 0;
+    for (int i = 0; i < PROFILE_BUCKETS; i++) {
+        for (ProfileEntry *entry = interp->profile_table[i]; entry; entry = entry->next) entries[count++] = entry;
+    }
+    qsort(entries, count, sizeof(ProfileEntry *), compare_profile_entries);
+    fprintf(stderr, "%-24s %12s %14s %14s %12s\n", "function", "calls", "inclusive ms", "self ms", "allocations");
+    for (int i = 0; i < count; i++) {
+        fprintf(stderr, "%-24s %12ld %14.3f %14.3f %12ld\n", entries[i]->name, entries[i]->calls,
+                entries[i]->inclusive_ns / 1e6, entries[i]->self_ns / 1e6, entries[i]->allocations);
+    }
+    free(entries);
+
+    if (interp->profile_stacks_path) {
+        FILE *out = fopen(interp->profile_stacks_path, "w");
+        if (!out) {
+            fprintf(stderr, "Cannot write %s\n", interp->profile_stacks_path);
+            return;
+        }
+        char root[] = "toplevel";
+        write_profile_stacks(out, &interp->profile_root, root, strlen(root));
+        fclose(out);
+    }
+}
+
+/* --- Statistics --- */
+
+// Hot-path counters, always on unless built with -DLISTSCRIPT_NO_STATS. Each
+// thread counts into its own cache-line-aligned block, so pmap workers never
+// write to a shared line, and :stats sums the blocks of every thread.
+#define CACHE_LINE 64
+
+typedef struct ThreadStats {
+    _Alignas(CACHE_LINE) long nodes[NODE_TYPE_COUNT]; // Evaluated, by type; the VM counts the node each instruction stands for
+    long primitive_calls[OP_HOST + 1]; // By opcode
+    long allocations;      // make_node calls
+    long allocation_bytes; // Their nodes, plus the data they own
+    long max_depth;        // Deepest nesting of eval calls, or of VM calls
+    long global_lookups;
+    long global_probes;    // Table slots read by those lookups
+    long local_lookups;
+    long closures;         // Made by nested function definitions
+    long captured;         // Values copied into them
+    struct ThreadStats *next; // In the registry
+} ThreadStats;
+
+static _Thread_local ThreadStats stats;
+
+#ifdef LISTSCRIPT_NO_STATS
+#define STAT_ADD(counter, n) ((void)0)
+#define STAT_MAX(counter, n) ((void)0)
+#else
+#define STAT_ADD(counter, n) (stats.counter += (n))
+#define STAT_MAX(counter, n) ((n) > stats.counter ? (void)(stats.counter = (n)) : (void)0)
+#endif
+#define STAT(counter) STAT_ADD(counter, 1)
+
+// Every thread with evaluation state has its block registered here. The
+// counts of threads that have exited are folded into stats_retired.
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadStats *stats_threads = NULL;
+static ThreadStats stats_retired;
+
+static void stats_fold(ThreadStats *total, ThreadStats *part) {
+    for (int i = 0; i < NODE_TYPE_COUNT; i++) total->nodes[i] += part->nodes[i];
+    for (int i = 0; i <= OP_HOST; i++) total->primitive_calls[i] += part->primitive_calls[i];
+    total->allocations += part->allocations;
+    total->allocation_bytes += part->allocation_bytes;
+    if (part->max_depth > total->max_depth) total->max_depth = part->max_depth;
+    total->global_lookups += part->global_lookups;
+    total->global_probes += part->global_probes;
+    total->local_lookups += part->local_lookups;
+    total->closures += part->closures;
+    total->captured += part->captured;
+}
+
+void stats_register() {
+    pthread_mutex_lock(&stats_lock);
+    stats.next = stats_threads;
+    stats_threads = &stats;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void stats_unregister() {
+    pthread_mutex_lock(&stats_lock);
+    ThreadStats **link = &stats_threads;
+    while (*link && *link != &stats) link = &(*link)->next;
+    if (*link) *link = stats.next;
+    stats_fold(&stats_retired, &stats);
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_unlock(&stats_lock);
+}
+
+// Sums the counters of all threads. Threads still running may be read
+// mid-update, so their counts can lag slightly.
+void stats_total(ThreadStats *total) {
+    memset(total, 0, sizeof(*total));
+    pthread_mutex_lock(&stats_lock);
+    stats_fold(total, &stats_retired);
+    for (ThreadStats *thread = stats_threads; thread; thread = thread->next) stats_fold(total, thread);
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/* --- Garbage Collector --- */
+
+// Nodes outside the parse arena live on a mark-sweep heap of fixed-size
+// pages. Collection only happens at safe points in eval, where every live
+// value is reachable from the roots: the global environment, the eval
+// stack of pending operators and arguments, and the active call frames.
+#define HEAP_PAGE_NODES 4096
+#define GC_MIN_THRESHOLD (1024 * 1024)
+#define EVAL_STACK_MAX (1024 * 1024)
+
+typedef struct HeapPage {
+    struct HeapPage *next;
+    Node nodes[HEAP_PAGE_NODES];
+} HeapPage;
+
+// Evaluation state is per thread; pmap workers run with the collector off
+// and the globals read-only
+static _Thread_local int in_worker = 0;
+static _Thread_local Node **eval_stack = NULL; // EVAL_STACK_MAX entries
+static _Thread_local int eval_sp = 0;
+static _Thread_local Frame *active_frame = NULL;
+
+void heap_account(long bytes) {
+    interp->gc_stats.heap_bytes += bytes;
+    if (interp->gc_stats.heap_bytes > interp->gc_stats.peak_heap_bytes) interp->gc_stats.peak_heap_bytes = interp->gc_stats.heap_bytes;
+    if (interp->gc_stats.heap_bytes > interp->gc_threshold) interp->gc_requested = 1;
+}
+
+Node *heap_alloc_node() {
+    if (!interp->free_nodes) {
+        HeapPage *page = malloc(sizeof(HeapPage));
+        page->next = interp->heap_pages;
+        interp->heap_pages = page;
+        for (int i = HEAP_PAGE_NODES - 1; i >= 0; i--) {
+            page->nodes[i].flags = NODE_FREE;
+            page->nodes[i].value.compound.children = (Node **)interp->free_nodes;
+            interp->free_nodes = &page->nodes[i];
+        }
+    }
+    Node *node = interp->free_nodes;
+    interp->free_nodes = (Node *)node->value.compound.children;
+    memset(node, 0, sizeof(Node));
+    interp->gc_stats.nodes_allocated++;
+    interp->gc_stats.live_nodes++;
+    heap_account(sizeof(Node));
+    return node;
+}
+
+// Zeroed storage owned by `node`: from the arena for arena nodes, otherwise
+// malloc'd and released when the node is swept
+void *node_data(Node *node, size_t size) {
+    STAT_ADD(allocation_bytes, size);
+    if (node->flags & NODE_ARENA) return arena_alloc(alloc_arena ? alloc_arena : &interp->ast_arena, size);
+    heap_account(size);
+    return calloc(1, size ? size : 1);
+}
+
+char *node_strndup(Node *node, const char *str, size_t length) {
+    char *copy = node_data(node, length + 1);
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+char *node_strdup(Node *node, const char *str) {
+    return node_strndup(node, str, strlen(str));
+}
+
+void gc_push(Node *node) {
+    if (!node || (node->flags & (NODE_ARENA | NODE_STATIC | NODE_MARK))) return;
+    node->flags |= NODE_MARK;
+    if (interp->mark_count == interp->mark_capacity) {
+        interp->mark_capacity = interp->mark_capacity ? interp->mark_capacity * 2 : 1024;
+        interp->mark_stack = realloc(interp->mark_stack, interp->mark_capacity * sizeof(Node *));
+    }
+    interp->mark_stack[interp->mark_count++] = node;
+}
+
+void gc_mark() {
+    while (interp->mark_count > 0) {
+        Node *node = interp->mark_stack[--interp->mark_count];
+        switch (node->type) {
+            case LIST_BUFFER:
+                for (int i = node->value.buffer.start; i < node->value.buffer.capacity; i++) {
+                    gc_push(node->value.buffer.items[i]);
+                }
+                break;
+            case STRING:
+                gc_push(node->value.str.base);
+                gc_push(node->value.str.right);
+                break;
+            case VECTOR:
+                gc_push(node->value.vector.owner);
+                break;
+            case SEQ:
+                if (node->value.seq.kind == SEQ_RANGE) break;
+                gc_push(node->value.seq.source);
+                if (node->value.seq.kind != SEQ_TAKE) gc_push(node->value.seq.fn);
+                gc_push(node->value.seq.head);
+                break;
+            case CLOSURE:
+                gc_push(node->value.closure.def);
+                for (int i = 0; i < node->value.closure.count; i++) gc_push(node->value.closure.values[i]);
+                break;
+            case LIST:
+                if (node->value.compound.owner) gc_push(node->value.compound.owner);
+                /* fallthrough */
+            case DEF:
+                if (node->type == DEF) gc_push(node->value.compound.captures);
+                /* fallthrough */
+            case ARGS:
+            case DATA:
+            case IF:
+            case FUNCTION_CALL:
+                if (node->type == LIST || node->type == FUNCTION_CALL) gc_push(node->value.compound.folded);
+                for (int i = 0; i < node->value.compound.child_count; i++) {
+                    gc_push(node->value.compound.children[i]);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void gc_finalize(Node *node) {
+    switch (node->type) {
+        case STRING:
+            // Views and ropes own no chars
+            if (node->value.str.chars && !node->value.str.base) {
+                interp->gc_stats.heap_bytes -= node->value.str.length + 1;
+                free(node->value.str.chars);
+            }
+            break;
+        case ERROR:
+            // A detailed error's message, if it was read, is not counted
+            if (node->value.error.code == ERR_MESSAGE) interp->gc_stats.heap_bytes -= strlen(node->value.error.message) + 1;
+            free(node->value.error.message);
+            break;
+        case LIST_BUFFER:
+            interp->gc_stats.heap_bytes -= node->value.buffer.capacity * sizeof(Node *);
+            free(node->value.buffer.items);
+            break;
+        case VECTOR:
+            if (node->value.vector.owner) break;
+            interp->gc_stats.heap_bytes -= node->value.vector.length * sizeof(long);
+            free(node->value.vector.items);
+            break;
+        case CLOSURE:
+            interp->gc_stats.heap_bytes -= node->value.closure.count * sizeof(Node *);
+            free(node->value.closure.values);
+            break;
+        case LIST:
+            if (node->value.compound.owner) break; // A slice shares its owner's children
+            /* fallthrough */
+        case DEF:
+            if (node->type == DEF) free(node->value.compound.code);
+            /* fallthrough */
+        case ARGS:
+        case DATA:
+        case IF:
+        case FUNCTION_CALL:
+            interp->gc_stats.heap_bytes -= node->value.compound.child_count * sizeof(Node *);
+            free(node->value.compound.children);
+            break;
+        default:
+            break;
+    }
+}
+
+// The memo cache, defined below, is a root set of its own
+void memo_mark();
+
+void gc_collect() {
+    clock_t start = clock();
+    for (int i = 0; i < interp->global_env.capacity; i++) {
+        if (interp->global_env.slots[i].name) gc_push(interp->global_env.slots[i].value);
+    }
+    for (int i = 0; i < eval_sp; i++) {
+        gc_push(eval_stack[i]);
+    }
+    for (Frame *frame = active_frame; frame; frame = frame->caller) {
+        for (int i = 0; i < frame->count; i++) gc_push(frame->slots[i]);
+    }
+    for (Script *script = interp->scripts; script; script = script->next) {
+        for (int i = 0; i < script->count; i++) gc_push(script->forms[i]);
+    }
+    memo_mark();
+    gc_mark();
+
+    for (HeapPage *page = interp->heap_pages; page; page = page->next) {
+        for (int i = 0; i < HEAP_PAGE_NODES; i++) {
+            Node *node = &page->nodes[i];
+            if (node->flags & NODE_FREE) continue;
+            if (node->flags & NODE_MARK) {
+                node->flags &= ~NODE_MARK;
+                continue;
+            }
+            gc_finalize(node);
+            node->flags = NODE_FREE;
+            node->value.compound.children = (Node **)interp->free_nodes;
+            interp->free_nodes = node;
+            interp->gc_stats.nodes_freed++;
+            interp->gc_stats.live_nodes--;
+            interp->gc_stats.heap_bytes -= sizeof(Node);
+        }
+    }
+
+    interp->gc_threshold = interp->gc_stats.heap_bytes * 2;
+    if (interp->gc_threshold < GC_MIN_THRESHOLD) interp->gc_threshold = GC_MIN_THRESHOLD;
+    if (interp->heap_limit && interp->gc_threshold > interp->heap_limit) interp->gc_threshold = interp->heap_limit;
+    interp->gc_requested = 0;
+
+    double pause_ms = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+    interp->gc_stats.collections++;
+    interp->gc_stats.total_pause_ms += pause_ms;
+    if (pause_ms > interp->gc_stats.max_pause_ms) interp->gc_stats.max_pause_ms = pause_ms;
+}
+
+// Runs a requested collection. Returns 0 if the heap is still over its limit.
+int gc_safe_point() {
+    if (!interp->gc_requested || in_worker) return 1;
+    gc_collect();
+    return !interp->heap_limit || interp->gc_stats.heap_bytes <= interp->heap_limit;
+}
+
+void print_gc_stats() {
+    out_printf("collections: %ld\n", interp->gc_stats.collections);
+    out_printf("nodes allocated: %ld\n", interp->gc_stats.nodes_allocated);
+    out_printf("nodes freed: %ld\n", interp->gc_stats.nodes_freed);
+    out_printf("live nodes: %ld\n", interp->gc_stats.live_nodes);
+    out_printf("heap bytes: %zu\n", interp->gc_stats.heap_bytes);
+    out_printf("peak heap bytes: %zu\n", interp->gc_stats.peak_heap_bytes);
+    if (interp->heap_limit) out_printf("heap limit: %zu\n", interp->heap_limit);
+    else out_printf("heap limit: none\n");
+    out_printf("total pause: %.3f ms\n", interp->gc_stats.total_pause_ms);
+    out_printf("max pause: %.3f ms\n", interp->gc_stats.max_pause_ms);
+}
+
+// Node creation functions (memory allocation helpers)
+Node *make_node(NodeType type) {
+    Node *node;
+    if (alloc_arena) {
+        node = arena_alloc(alloc_arena, sizeof(Node));
+        node->flags = NODE_ARENA;
+    } else {
+        node = heap_alloc_node();
+    }
+    node->type = type;
+    STAT(allocations);
+    STAT_ADD(allocation_bytes, sizeof(Node));
+    if (profiling) profile_allocation();
+    return node;
+}
+
+// Preallocated booleans and small integers, handed out instead of allocating
+#define SMALL_INT_MIN -128
+#define SMALL_INT_MAX 1024
+
+static Node boolean_nodes[2] = {
+    { BOOLEAN, NODE_STATIC | NODE_PERSISTENT, { .number = 0 } },
+    { BOOLEAN, NODE_STATIC | NODE_PERSISTENT, { .number = 1 } },
+};
+static Node small_ints[SMALL_INT_MAX - SMALL_INT_MIN + 1];
+
+// Indexed by ErrorCode; messages of detailed codes are formats for the detail
+static const char *error_messages[ERR_COUNT] = {
+    [ERR_UNDEFINED_SYMBOL] = "Undefined symbol '%s'",
+    [ERR_UNDEFINED_FUNCTION] = "Undefined function '%s'",
+    [ERR_CONSTANT] = "Cannot redefine constant '%s'",
+    [ERR_VECTOR_OPERAND] = "Type error: '%s' expects a vector and a vector or number",
+    [ERR_VECTOR_LENGTH] = "Error: '%s' vectors differ in length",
+    [ERR_PARALLEL_FUNCTION] = "Type error: '%s' expects a function or primitive",
+    [ERR_PARALLEL_LIST] = "Type error: '%s' expects a list",
+    [ERR_SEQUENCE_FUNCTION] = "Type error: '%s' expects a function or primitive",
+    [ERR_SEQUENCE_SOURCE] = "Type error: '%s' expects a list, vector or sequence",
+    [ERR_UNBOUND_CAPTURE] = "Unbound variable '%s': its def had not run when the closure was made",
+    [ERR_OUT_OF_MEMORY] = "Out of memory: heap limit exceeded",
+    [ERR_STACK_OVERFLOW] = "Stack overflow",
+    [ERR_RECURSION_DEPTH] = "Stack overflow: recursion too deep",
+    [ERR_NOT_A_FUNCTION] = "Cannot apply a non-function or undefined operator",
+    [ERR_BAD_EXPRESSION] = "Cannot evaluate expression of this type",
+    [ERR_IF_CONDITION] = "'if' condition must be a boolean",
+    [ERR_ARITY] = "Arity mismatch in user-defined function",
+    [ERR_NESTED_RUN] = "ls_run cannot be called from a primitive",
+    [ERR_ARITHMETIC_ARITY] = "Arity mismatch: Expected 2 arguments for arithmetic operator",
+    [ERR_COMPARISON_ARITY] = "Arity mismatch: Expected 2 arguments for comparison operator",
+    [ERR_NUMBER_TYPE] = "Type error: Arguments must be numbers",
+    [ERR_DIVISION_BY_ZERO] = "Division by zero",
+    [ERR_ERROR_P_ARITY] = "Arity mismatch: 'error?' expects 1 argument",
+    [ERR_WRITE_ARITY] = "Arity mismatch: 'write' expects 1 argument",
+    [ERR_FIRST_ARITY] = "Arity mismatch: 'first' expects 1 argument",
+    [ERR_FIRST_TYPE] = "Type error: 'first' expects a list",
+    [ERR_FIRST_EMPTY] = "Error: 'first' called on empty list",
+    [ERR_FIRST_EMPTY_VECTOR] = "Error: 'first' called on empty vector",
+    [ERR_FIRST_EMPTY_SEQUENCE] = "Error: 'first' called on empty sequence",
+    [ERR_REST_ARITY] = "Arity mismatch: 'rest' expects 1 argument",
+    [ERR_REST_TYPE] = "Type error: 'rest' expects a list",
+    [ERR_REST_EMPTY] = "Error: 'rest' called on empty list",
+    [ERR_REST_EMPTY_VECTOR] = "Error: 'rest' called on empty vector",
+    [ERR_REST_EMPTY_SEQUENCE] = "Error: 'rest' called on empty sequence",
+    [ERR_CONS_ARITY] = "Arity mismatch: 'cons' expects 2 arguments",
+    [ERR_CONS_TYPE] = "Type error: 'cons' second argument must be a list",
+    [ERR_STRLEN_ARITY] = "Arity mismatch: 'strlen' expects 1 argument",
+    [ERR_STRLEN_TYPE] = "Type error: 'strlen' expects a string",
+    [ERR_CONCAT_TYPE] = "Type error: 'concat' expects strings",
+    [ERR_SUBSTR_ARITY] = "Arity mismatch: 'substr' expects 2 or 3 arguments",
+    [ERR_SUBSTR_TYPE] = "Type error: 'substr' expects a string",
+    [ERR_SUBSTR_RANGE_TYPE] = "Type error: 'substr' start and length must be numbers",
+    [ERR_SUBSTR_RANGE] = "Error: 'substr' range is out of bounds",
+    [ERR_SPLIT_ARITY] = "Arity mismatch: 'split' expects 2 arguments",
+    [ERR_SPLIT_TYPE] = "Type error: 'split' expects two strings",
+    [ERR_SPLIT_SEPARATOR] = "Error: 'split' separator is empty",
+    [ERR_VECTOR_TYPE] = "Type error: 'vector' expects numbers or a list of numbers",
+    [ERR_VSUM_ARITY] = "Arity mismatch: 'vsum' expects 1 argument",
+    [ERR_VSUM_TYPE] = "Type error: 'vsum' expects a vector",
+    [ERR_VDOT_ARITY] = "Arity mismatch: 'vdot' expects 2 arguments",
+    [ERR_VDOT_TYPE] = "Type error: 'vdot' expects two vectors",
+    [ERR_VDOT_LENGTH] = "Error: 'vdot' vectors differ in length",
+    [ERR_VMAP_ADD_ARITY] = "Arity mismatch: 'vmap+' expects 2 arguments",
+    [ERR_VCMP_ARITY] = "Arity mismatch: 'vcmp' expects 3 arguments",
+    [ERR_VCMP_OPERATOR] = "Type error: 'vcmp' operator must be <, > or eq?",
+    [ERR_RANGE_ARITY] = "Arity mismatch: 'range' expects 1 to 3 arguments",
+    [ERR_RANGE_TYPE] = "Type error: 'range' bounds and step must be numbers",
+    [ERR_RANGE_STEP] = "Error: 'range' step is zero",
+    [ERR_MAP_ARITY] = "Arity mismatch: 'map' expects 2 arguments",
+    [ERR_FILTER_ARITY] = "Arity mismatch: 'filter' expects 2 arguments",
+    [ERR_FILTER_RESULT] = "Type error: 'filter' predicate must return a boolean",
+    [ERR_TAKE_ARITY] = "Arity mismatch: 'take' expects 2 arguments",
+    [ERR_TAKE_COUNT] = "Type error: 'take' count must be a number of at least 0",
+    [ERR_PMAP_ARITY] = "Arity mismatch: 'pmap' expects 2 arguments",
+    [ERR_PFILTER_ARITY] = "Arity mismatch: 'pfilter' expects 2 arguments",
+    [ERR_PFILTER_RESULT] = "Type error: 'pfilter' predicate must return a boolean",
+    [ERR_PREDUCE_ARITY] = "Arity mismatch: 'preduce' expects 3 arguments",
+};
+static Node error_nodes[ERR_COUNT];
+
+void init_constants() {
+    for (long i = SMALL_INT_MIN; i <= SMALL_INT_MAX; i++) {
+        Node *node = &small_ints[i - SMALL_INT_MIN];
+        node->type = NUMBER;
+        node->flags = NODE_STATIC | NODE_PERSISTENT;
+        node->value.number = i;
+    }
+    for (int code = ERR_DETAILED + 1; code < ERR_COUNT; code++) {
+        Node *node = &error_nodes[code];
+        node->type = ERROR;
+        node->flags = NODE_STATIC | NODE_PERSISTENT;
+        node->value.error.message = (char *)error_messages[code];
+        node->value.error.code = code;
+    }
+}
+
+Node *make_number(long num) {
+    if (num >= SMALL_INT_MIN && num <= SMALL_INT_MAX) return &small_ints[num - SMALL_INT_MIN];
+    Node *node = make_node(NUMBER);
+    node->value.number = num;
+    return node;
+}
+
+Node *make_symbol(char *name) {
+    Node *node = make_node(SYMBOL);
+    node->value.name = intern(name);
+    return node;
+}
+
+Node *make_string_n(const char *chars, int length) {
+    Node *node = make_node(STRING);
+    node->value.str.chars = node_strndup(node, chars, length);
+    node->value.str.length = length;
+    return node;
+}
+
+Node *make_string(char *str) {
+    return make_string_n(str, strlen(str));
+}
+
+// Symbols and strings straight from a token slice
+Node *make_token_symbol() {
+    Node *node = make_node(SYMBOL);
+    node->value.name = intern_n(interp->token, interp->token_length);
+    return node;
+}
+
+Node *make_token_string() {
+    return make_string_n(interp->token, interp->token_length);
+}
+
+// Ropes deeper than this are flattened when concatenated onto, which keeps
+// reading them iterative and copying them (in copy_node) shallow
+#define ROPE_MAX_DEPTH 32
+// Concatenations shorter than this are copied flat rather than roped
+#define ROPE_MIN_LENGTH 64
+// Appends merge into a rope's last leaf while it stays under this
+#define ROPE_LEAF_LENGTH 512
+
+// Copies a rope's leaves, left to right
+static void rope_copy(Node *rope, char *out) {
+    Node *stack[ROPE_MAX_DEPTH + 2];
+    int sp = 0;
+    stack[sp++] = rope;
+    while (sp > 0) {
+        Node *node = stack[--sp];
+        if (node->value.str.chars) {
+            memcpy(out, node->value.str.chars, node->value.str.length);
+            out += node->value.str.length;
+        } else {
+            stack[sp++] = node->value.str.right;
+            stack[sp++] = node->value.str.base;
+        }
+    }
+}
+
+// Gives a string its own NUL-terminated chars, turning a rope or view into
+// a flat string in place (its value is unchanged). Workers may share the
+// node, so they only get a private copy, from their arena.
+static char *string_flatten(Node *node) {
+    int length = node->value.str.length;
+    char *chars = in_worker ? arena_alloc(alloc_arena, length + 1) : node_data(node, length + 1);
+    if (node->value.str.chars) memcpy(chars, node->value.str.chars, length);
+    else rope_copy(node, chars);
+    chars[length] = '\0';
+    if (!in_worker) {
+        node->value.str.chars = chars;
+        node->value.str.depth = 0;
+        node->value.str.base = NULL;
+        node->value.str.right = NULL;
+    }
+    return chars;
+}
+
+// A string's `length` chars, which a view does not terminate
+char *string_chars(Node *node) {
+    return node->value.str.chars ? node->value.str.chars : string_flatten(node);
+}
+
+char *string_cstr(Node *node) {
+    return node->value.str.chars && !node->value.str.base ? node->value.str.chars : string_flatten(node);
+}
+
+int string_equal(Node *a, Node *b) {
+    return a->value.str.length == b->value.str.length &&
+           memcmp(string_chars(a), string_chars(b), a->value.str.length) == 0;
+}
+
+// `length` chars of `string` from `start`, shared rather than copied
+Node *make_string_view(Node *string, int start, int length) {
+    if (!string->value.str.chars) {
+        char *chars = string_flatten(string);
+        // A worker's flattened copy is private, so it cannot be shared
+        if (in_worker) return make_string_n(chars + start, length);
+    }
+    Node *view = make_node(STRING);
+    view->value.str.chars = string->value.str.chars + start;
+    view->value.str.length = length;
+    view->value.str.base = string->value.str.base ? string->value.str.base : string;
+    return view;
+}
+
+// A rope half that is too deep to nest further, as a flat string
+static Node *rope_half(Node *node) {
+    if (node->value.str.depth < ROPE_MAX_DEPTH) return node;
+    char *chars = string_flatten(node);
+    return in_worker ? make_string_n(chars, node->value.str.length) : node;
+}
+
+static Node *make_flat_concat(Node *left, Node *right) {
+    int length = left->value.str.length + right->value.str.length;
+    Node *node = make_node(STRING);
+    char *chars = node_data(node, length + 1);
+    memcpy(chars, string_chars(left), left->value.str.length);
+    memcpy(chars + left->value.str.length, string_chars(right), right->value.str.length);
+    node->value.str.chars = chars;
+    node->value.str.length = length;
+    return node;
+}
+
+Node *make_rope(Node *left, Node *right) {
+    int length = left->value.str.length + right->value.str.length;
+    if (length < ROPE_MIN_LENGTH || left->value.str.length == 0 || right->value.str.length == 0) {
+        return make_flat_concat(left, right);
+    }
+    // Appending a little at a time grows the last leaf instead of the rope's depth
+    if (!left->value.str.chars && left->value.str.right->value.str.chars &&
+        left->value.str.right->value.str.length + right->value.str.length < ROPE_LEAF_LENGTH) {
+        right = make_flat_concat(left->value.str.right, right);
+        left = left->value.str.base;
+        length = left->value.str.length + right->value.str.length;
+    }
+    left = rope_half(left);
+    right = rope_half(right);
+    Node *rope = make_node(STRING);
+    rope->value.str.length = length;
+    rope->value.str.depth = 1 + (left->value.str.depth > right->value.str.depth ? left->value.str.depth : right->value.str.depth);
+    rope->value.str.base = left;
+    rope->value.str.right = right;
+    return rope;
+}
+
+Node *make_boolean(int value) {
+    return &boolean_nodes[value != 0];
+}
+
+Node *make_error(char *message) {
+    Node *node = make_node(ERROR);
+    node->value.error.message = node_strdup(node, message);
+    node->value.error.code = ERR_MESSAGE;
+    return node;
+}
+
+// The preallocated error for a code with a fixed message
+Node *error_node(ErrorCode code) {
+    return &error_nodes[code];
+}
+
+// An error of a detailed code; `detail` must outlive it, as interned names do
+Node *make_error_detail(ErrorCode code, char *detail) {
+    Node *node = make_node(ERROR);
+    node->value.error.code = code;
+    node->value.error.detail = detail;
+    return node;
+}
+
+// Hosts read errors outside any call, with no interpreter to count the
+// message against, so a heap error's formatted message is not counted in
+// heap bytes. Workers may share the node, so they format a private copy.
+char *error_message(Node *node) {
+    if (node->value.error.message) return node->value.error.message;
+    char message[160];
+    snprintf(message, sizeof(message), error_messages[node->value.error.code], node->value.error.detail);
+    size_t size = strlen(message) + 1;
+    if (in_worker) return memcpy(arena_alloc(alloc_arena, size), message, size);
+    char *copy = node->flags & NODE_ARENA ? node_data(node, size) : malloc(size);
+    return node->value.error.message = memcpy(copy, message, size);
+}
+
+Node *make_compound_node(NodeType type, int child_count) {
+    Node *node = make_node(type);
+    node->value.compound.child_count = child_count;
+    node->value.compound.children = node_data(node, child_count * sizeof(Node *));
+    return node;
+}
+
+// Appends to a compound node built up from zero children. Capacity is
+// implied by the count: 4, then each power of two.
+void append_child(Node *node, Node *child) {
+    int count = node->value.compound.child_count;
+    if (count == 0 || (count >= 4 && (count & (count - 1)) == 0)) {
+        size_t capacity = count ? count * 2 : 4;
+        if (node->flags & NODE_ARENA) {
+            Node **children = arena_alloc(&interp->ast_arena, capacity * sizeof(Node *));
+            memcpy(children, node->value.compound.children, count * sizeof(Node *));
+            node->value.compound.children = children;
+        } else {
+            node->value.compound.children = realloc(node->value.compound.children, capacity * sizeof(Node *));
+        }
+    }
+    if (!(node->flags & NODE_ARENA)) heap_account(sizeof(Node *));
+    node->value.compound.children[node->value.compound.child_count++] = child;
+}
+
+// Makes a value safe to keep after the line's arenas reset: arena nodes are
+// copied to the heap, and heap nodes have their arena children replaced in
+// place (values are immutable, so sharers cannot tell). NODE_PERSISTENT
+// marks nodes already known to reach no arena memory.
+Node *copy_node(Node *node) {
+    if (!node || (node->flags & NODE_PERSISTENT)) return node;
+    Node *copy = node;
+    if (node->flags & NODE_ARENA) {
+        copy = make_node(node->type);
+        copy->value = node->value;
+        copy->flags |= node->flags & (NODE_MEMO | NODE_CONST | NODE_LATE);
+    }
+    switch (node->type) {
+        case LIST_BUFFER:
+            if (copy != node) copy->value.buffer.items = node_data(copy, node->value.buffer.capacity * sizeof(Node *));
+            for (int i = node->value.buffer.start; i < node->value.buffer.capacity; i++) {
+                copy->value.buffer.items[i] = copy_node(node->value.buffer.items[i]);
+            }
+            break;
+        case VECTOR:
+            if (node->value.vector.owner) {
+                // A view keeps its offset into the copied owner
+                Node *owner = copy_node(node->value.vector.owner);
+                copy->value.vector.items = owner->value.vector.items + (node->value.vector.items - node->value.vector.owner->value.vector.items);
+                copy->value.vector.owner = owner;
+            } else if (copy != node) {
+                copy->value.vector.items = node_data(copy, node->value.vector.length * sizeof(long));
+                memcpy(copy->value.vector.items, node->value.vector.items, node->value.vector.length * sizeof(long));
+            }
+            break;
+        case STRING:
+            if (node->value.str.base) {
+                // A view keeps its offset into the copied base; a rope copies its halves
+                Node *base = copy_node(node->value.str.base);
+                if (node->value.str.chars) {
+                    copy->value.str.chars = base->value.str.chars + (node->value.str.chars - node->value.str.base->value.str.chars);
+                } else {
+                    copy->value.str.right = copy_node(node->value.str.right);
+                }
+                copy->value.str.base = base;
+            } else if (copy != node) {
+                copy->value.str.chars = node_strndup(copy, node->value.str.chars, node->value.str.length);
+            }
+            break;
+        case SEQ:
+            if (node->value.seq.kind == SEQ_RANGE) break;
+            copy->value.seq.source = copy_node(node->value.seq.source);
+            if (node->value.seq.kind != SEQ_TAKE) copy->value.seq.fn = copy_node(node->value.seq.fn);
+            copy->value.seq.head = copy_node(node->value.seq.head);
+            break;
+        case ERROR:
+            // A detailed copy formats its own message when it is read
+            if (copy != node) copy->value.error.message = node->value.error.code == ERR_MESSAGE ? node_strdup(copy, node->value.error.message) : NULL;
+            break;
+        case CLOSURE:
+            copy->value.closure.def = copy_node(node->value.closure.def);
+            if (copy != node) copy->value.closure.values = node_data(copy, node->value.closure.count * sizeof(Node *));
+            for (int i = 0; i < node->value.closure.count; i++) {
+                copy->value.closure.values[i] = copy_node(node->value.closure.values[i]);
+            }
+            break;
+        case DEF:
+            copy->value.compound.captures = copy_node(node->value.compound.captures);
+            // The copy compiles its own bytecode, against its own nodes
+            if (copy != node) copy->value.compound.code = NULL;
+            /* fallthrough */
+        case LIST:
+            // The collector marks all of an owner's children, so a slice persists all of them.
+            // A copied slice gets its own children and no longer needs the owner.
+            if (node->type == LIST && node->value.compound.owner) {
+                if (copy != node) copy->value.compound.owner = NULL;
+                else copy_node(node->value.compound.owner);
+            }
+            /* fallthrough */
+        case ARGS:
+        case DATA:
+        case IF:
+        case FUNCTION_CALL:
+            if (node->type == LIST || node->type == FUNCTION_CALL) copy->value.compound.folded = copy_node(node->value.compound.folded);
+            if (copy != node) copy->value.compound.children = node_data(copy, node->value.compound.child_count * sizeof(Node *));
+            for (int i = 0; i < node->value.compound.child_count; i++) {
+                copy->value.compound.children[i] = copy_node(node->value.compound.children[i]);
+            }
+            break;
+        default:
+            break;
+    }
+    copy->flags |= NODE_PERSISTENT;
+    return copy;
+}
+
+Node *persist(Node *node) {
+    Arena *saved = alloc_arena;
+    alloc_arena = NULL;
+    Node *copy = copy_node(node);
+    alloc_arena = saved;
+    return copy;
+}
+
+/* --- Memoization --- */
+
+// Results of functions declared with defmemo, keyed by the function and the
+// structure of its arguments. At most memo_limit entries are kept, evicting
+// the least recently used. Any global redefinition flushes the cache, since
+// a cached result may depend on the old value.
+typedef struct MemoEntry {
+    struct MemoEntry *chain; // Next entry in the same bucket
+    struct MemoEntry *newer;
+    struct MemoEntry *older;
+    unsigned long hash;
+    Node *fn;
+    Node *value;
+    int arg_count;
+    Node *args[];
+} MemoEntry;
+
+#define MEMO_DEFAULT_LIMIT 65536
+
+unsigned long memo_hash_value(Node *node) {
+    switch (node->type) {
+        case NUMBER:
+        case BOOLEAN:
+            return (unsigned long)node->value.number * 0x9E3779B97F4A7C15UL + node->type;
+        case STRING:
+            return hash_name(string_chars(node), node->value.str.length);
+        case VECTOR: {
+            unsigned long h = VECTOR;
+            for (int i = 0; i < node->value.vector.length; i++) h = h * 31 + node->value.vector.items[i];
+            return h;
+        }
+        case LIST:
+        case DATA: {
+            unsigned long h = node->type;
+            for (int i = 0; i < node->value.compound.child_count; i++) {
+                h = h * 31 + memo_hash_value(node->value.compound.children[i]);
+            }
+            return h;
+        }
+        default:
+            return (uintptr_t)node >> 3;
+    }
+}
+
+int memo_equal(Node *a, Node *b) {
+    if (a == b) return 1;
+    if (a->type != b->type) return 0;
+    switch (a->type) {
+        case NUMBER:
+        case BOOLEAN:
+            return a->value.number == b->value.number;
+        case STRING:
+            return string_equal(a, b);
+        case VECTOR:
+            return a->value.vector.length == b->value.vector.length &&
+                   memcmp(a->value.vector.items, b->value.vector.items, a->value.vector.length * sizeof(long)) == 0;
+        case LIST:
+        case DATA:
+            if (a->value.compound.child_count != b->value.compound.child_count) return 0;
+            for (int i = 0; i < a->value.compound.child_count; i++) {
+                if (!memo_equal(a->value.compound.children[i], b->value.compound.children[i])) return 0;
+            }
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+unsigned long memo_key_hash(Node *fn, Node **args, int arg_count) {
+    unsigned long h = (uintptr_t)fn >> 3;
+    for (int i = 0; i < arg_count; i++) h = h * 1000003 ^ memo_hash_value(args[i]);
+    return h;
+}
+
+static void memo_unlink(MemoEntry *entry) {
+    if (entry->newer) entry->newer->older = entry->older;
+    else interp->memo_newest = entry->older;
+    if (entry->older) entry->older->newer = entry->newer;
+    else interp->memo_oldest = entry->newer;
+}
+
+static void memo_push_newest(MemoEntry *entry) {
+    entry->newer = NULL;
+    entry->older = interp->memo_newest;
+    if (interp->memo_newest) interp->memo_newest->newer = entry;
+    interp->memo_newest = entry;
+    if (!interp->memo_oldest) interp->memo_oldest = entry;
+}
+
+// Returns the cached result of fn on args, or NULL
+Node *memo_find(Node *fn, Node **args, int arg_count, unsigned long hash) {
+    if (!interp->memo_count || in_worker) return NULL;
+    for (MemoEntry *entry = interp->memo_table[hash & (interp->memo_buckets - 1)]; entry; entry = entry->chain) {
+        if (entry->hash != hash || entry->fn != fn || entry->arg_count != arg_count) continue;
+        int i = 0;
+        while (i < arg_count && memo_equal(entry->args[i], args[i])) i++;
+        if (i < arg_count) continue;
+        memo_unlink(entry);
+        memo_push_newest(entry);
+        return entry->value;
+    }
+    return NULL;
+}
+
+static void memo_remove(MemoEntry *entry) {
+    MemoEntry **link = &interp->memo_table[entry->hash & (interp->memo_buckets - 1)];
+    while (*link != entry) link = &(*link)->chain;
+    *link = entry->chain;
+    memo_unlink(entry);
+    free(entry);
+    interp->memo_count--;
+}
+
+void memo_store(Node *fn, Node **args, int arg_count, unsigned long hash, Node *value) {
+    if (interp->memo_limit <= 0 || value->type == ERROR || in_worker) return;
+    if (interp->memo_count >= interp->memo_limit) memo_remove(interp->memo_oldest);
+    if (interp->memo_count >= interp->memo_buckets) {
+        long new_buckets = interp->memo_buckets ? interp->memo_buckets * 2 : 256;
+        MemoEntry **new_table = calloc(new_buckets, sizeof(MemoEntry *));
+        for (MemoEntry *entry = interp->memo_newest; entry; entry = entry->older) {
+            entry->chain = new_table[entry->hash & (new_buckets - 1)];
+            new_table[entry->hash & (new_buckets - 1)] = entry;
+        }
+        free(interp->memo_table);
+        interp->memo_table = new_table;
+        interp->memo_buckets = new_buckets;
+    }
+    MemoEntry *entry = malloc(sizeof(MemoEntry) + arg_count * sizeof(Node *));
+    entry->hash = hash;
+    entry->fn = fn;
+    entry->arg_count = arg_count;
+    for (int i = 0; i < arg_count; i++) entry->args[i] = persist(args[i]);
+    entry->value = persist(value);
+    entry->chain = interp->memo_table[hash & (interp->memo_buckets - 1)];
+    interp->memo_table[hash & (interp->memo_buckets - 1)] = entry;
+    memo_push_newest(entry);
+    interp->memo_count++;
+}
+
+void memo_clear() {
+    while (interp->memo_newest) memo_remove(interp->memo_newest);
+}
+
+void memo_mark() {
+    for (MemoEntry *entry = interp->memo_newest; entry; entry = entry->older) {
+        gc_push(entry->fn);
+        for (int i = 0; i < entry->arg_count; i++) gc_push(entry->args[i]);
+        gc_push(entry->value);
+    }
+}
+
+#define ENV_MIN_CAPACITY 256
+
+// Home slot of an interned name; the low bits of a pointer are always zero
+static inline int env_home(Env *env, char *name) {
+    return (int)((((uintptr_t)name >> 3) * 0x9E3779B97F4A7C15ULL) >> 32) & (env->capacity - 1);
+}
+
+// Returns the slot holding name, or the empty slot where it would go
+static Binding *env_find(Env *env, char *name) {
+    int i = env_home(env, name);
+    while (env->slots[i].name && env->slots[i].name != name) i = (i + 1) & (env->capacity - 1);
+    return &env->slots[i];
+}
+
+static void env_grow(Env *env) {
+    Binding *old = env->slots;
+    int old_capacity = env->capacity;
+    env->capacity = old_capacity ? old_capacity * 2 : ENV_MIN_CAPACITY;
+    env->slots = calloc(env->capacity, sizeof(Binding));
+    for (int i = 0; i < old_capacity; i++) {
+        if (old[i].name) *env_find(env, old[i].name) = old[i];
+    }
+    free(old);
+}
+
+static int is_builtin(Binding *binding);
+static int is_pure_primitive(Node *node);
+
+// Redefining a name replaces its binding in place, so the old value can be
+// collected. Constants cannot be rebound, since code folded against them
+// would not see the change; returns 0 in that case.
+static int bind_global(Env *env, char *name, Node *value, int constant) {
+    name = intern(name);
+    // Keep the load factor at or below 3/4
+    if ((env->count + 1) * 4 > env->capacity * 3) env_grow(env);
+    Binding *binding = env_find(env, name);
+    if (!binding->name) {
+        binding->name = name;
+        env->count++;
+    } else if (binding->constant) {
+        return 0;
+    } else {
+        // New names cannot be cached yet, so only a rebinding invalidates caches
+        env->epoch++;
+        if (is_pure_primitive(binding->value) && is_builtin(binding)) env->rebound_ops |= 1u << binding->value->value.prim.opcode;
+    }
+    // A cached result may depend on this name, bound or not when it was
+    // computed, so new bindings invalidate the cache as well as rebindings
+    if (interp->memo_count) memo_clear();
+    binding->value = value;
+    binding->constant = constant;
+    return 1;
+}
+
+int define(Env *env, char *name, Node *value) {
+    return bind_global(env, name, value, 0);
+}
+
+int define_constant(Env *env, char *name, Node *value) {
+    return bind_global(env, name, value, 1);
+}
+
+Node *constant_error(char *name) {
+    return make_error_detail(ERR_CONSTANT, name);
+}
+
+// `name` must be interned
+Node *lookup(Env *env, char *name) {
+    if (!env->capacity) return NULL;
+    Binding *binding = env_find(env, name);
+    STAT(global_lookups);
+    STAT_ADD(global_probes, (((int)(binding - env->slots) - env_home(env, name)) & (env->capacity - 1)) + 1);
+    return binding->value;
+}
+
+// The value of a constant global, or NULL
+Node *lookup_constant(Env *env, char *name) {
+    if (!env->capacity) return NULL;
+    Binding *binding = env_find(env, name);
+    return binding->constant ? binding->value : NULL;
+}
+
+void print_env_stats(Env *env) {
+    long probes = 0;
+    int longest = 0;
+    for (int i = 0; i < env->capacity; i++) {
+        if (!env->slots[i].name) continue;
+        int distance = (i - env_home(env, env->slots[i].name)) & (env->capacity - 1);
+        probes += distance + 1;
+        if (distance + 1 > longest) longest = distance + 1;
+    }
+    out_printf("bindings: %d\n", env->count);
+    out_printf("slots: %d\n", env->capacity);
+    out_printf("load factor: %.3f\n", env->capacity ? (double)env->count / env->capacity : 0.0);
+    out_printf("average probe length: %.3f\n", env->count ? (double)probes / env->count : 0.0);
+    out_printf("longest probe: %d\n", longest);
+}
+
+// Frames get a few spare slots so a tail call can usually reuse one in place
+#define FRAME_MIN_SLOTS 8
+
+// Where `frame` ends on the frame stack; NULL (top level) ends before the first frame
+static inline char *frame_end(Frame *frame) {
+    return frame ? (char *)&frame->slots[frame->capacity] : NULL;
+}
+
+// Sets up `frame` (reused, or pushed fresh if NULL is passed) for a call to `fn`
+Frame *make_frame(Node *fn, Frame *caller, Frame *frame) {
+    int count = fn->value.compound.frame_size;
+    if (!frame) {
+        int capacity = count > FRAME_MIN_SLOTS ? count : FRAME_MIN_SLOTS;
+        frame = frame_push(sizeof(Frame) + capacity * sizeof(Node *));
+        frame->capacity = capacity;
+    }
+    memset(frame->slots, 0, count * sizeof(Node *));
+    frame->caller = caller;
+    frame->count = count;
+    frame->slots[0] = fn;
+    return frame;
+}
+
+// The value of a function definition running in `frame`: the DEF itself, or
+// if its body uses locals of the enclosing function, a closure holding their
+// current values. Nothing else of the enclosing frame is kept.
+Node *make_closure(Node *def, Frame *frame) {
+    Node *captures = def->value.compound.captures;
+    if (!captures) return def;
+    int count = captures->value.compound.child_count;
+    Node *closure = make_node(CLOSURE);
+    closure->value.closure.def = def;
+    closure->value.closure.count = count;
+    closure->value.closure.values = node_data(closure, count * sizeof(Node *));
+    for (int i = 0; i < count; i++) {
+        closure->value.closure.values[i] = frame->slots[captures->value.compound.children[i]->value.ref.slot];
+    }
+    STAT(closures);
+    STAT_ADD(captured, count);
+    return closure;
+}
+
+// Gives the value of a NODE_LATE local def to the closures made earlier in
+// `frame` that captured its slot while it was still empty, so local
+// functions can call siblings defined after them
+void patch_captures(Frame *frame, int slot, Node *value) {
+    for (int i = 1; i < frame->count; i++) {
+        Node *closure = frame->slots[i];
+        if (!closure || closure->type != CLOSURE) continue;
+        // Only closures of this frame's own defs, which sit in their def's slot
+        Node *def = closure->value.closure.def;
+        Node *name = def->value.compound.children[0];
+        if (name->type != LOCAL_REF || name->value.ref.slot != i) continue;
+        Node *captures = def->value.compound.captures;
+        for (int c = 0; c < captures->value.compound.child_count; c++) {
+            if (captures->value.compound.children[c]->value.ref.slot == slot && !closure->value.closure.values[c]) {
+                closure->value.closure.values[c] = value;
+            }
+        }
+    }
+}
+
+// The DEF run by a function value, a DEF or a closure
+static inline Node *function_def(Node *fn) {
+    return fn->type == CLOSURE ? fn->value.closure.def : fn;
+}
+
+// Primitives, function DEFs and closures can be called
+static inline int is_function(Node *fn) {
+    return fn->type == PRIMITIVE_OP || fn->type == CLOSURE || (fn->type == DEF && fn->value.compound.child_count == 3);
+}
+
+// Forward declaration
+Node *parse_expression();
+
+// Parser for content inside parentheses
+Node *parse_paren_content() {
+    Node *content = make_compound_node(LIST, 0);
+    while (gettoken() && !token_is(")")) {
+        Node *next = parse_expression();
+        if (next) append_child(content, next);
+    }
+    return content;
+}
+
+Node *parse_expression() {
+    if (token_is("def") || token_is("defmemo") || token_is("defconst")) {
+        Node *def_node = make_compound_node(DEF, 0);
+        if (token_is("defmemo")) def_node->flags |= NODE_MEMO;
+        if (token_is("defconst")) def_node->flags |= NODE_CONST;
+        
+        gettoken(); // Get the symbol to be defined
+        append_child(def_node, make_token_symbol());
+
+        gettoken(); // Get the next token, which should be 'args'
+        if (token_is("args")) {
+            gettoken(); // consume '('
+            Node *args_list = make_compound_node(ARGS, 0);
+            while(gettoken() && !token_is(")")) {
+                append_child(args_list, make_token_symbol());
+            }
+            append_child(def_node, args_list);
+            
+            gettoken(); // get the first token of the body
+            append_child(def_node, parse_expression());
+
+        } else {
+            // It's a simple variable assignment
+            append_child(def_node, parse_expression());
+        }
+        return def_node;
+    } else if (token_is("if")) {
+        Node *if_node = make_compound_node(IF, 3);
+        // Child 0: condition
+        gettoken();
+        if_node->value.compound.children[0] = parse_expression();
+        // Child 1: true branch
+        gettoken();
+        if_node->value.compound.children[1] = parse_expression();
+        // Child 2: false branch
+        gettoken();
+        if_node->value.compound.children[2] = parse_expression();
+        return if_node;
+    } else if (token_is("list")) {
+        Node *list_node = make_compound_node(LIST, 0);
+        gettoken(); // consume '('
+        while (gettoken() && !token_is(")")) {
+            Node *next = parse_expression();
+            if (next) append_child(list_node, next);
+        }
+        return list_node;
+    } else if (token_is("data")) {
+        Node *data_node = make_compound_node(DATA, 0);
+        gettoken(); // consume '('
+        while (gettoken() && !token_is(")")) {
+            Node *next = parse_expression();
+            if (next) append_child(data_node, next);
+        }
+        return data_node;
+    } else if (token_is("(")) { // New check for opening parenthesis
+        return parse_paren_content();
+    } else {
+        if (peek_char() == '(') {
+            Node *call_node = make_compound_node(FUNCTION_CALL, 0);
+            append_child(call_node, make_token_symbol());
+            gettoken(); // consume '('
+            Node *args_content = parse_paren_content();
+            for (int i = 0; i < args_content->value.compound.child_count; i++) {
+                append_child(call_node, args_content->value.compound.children[i]);
+            }
+            return call_node;
+        } else if (interp->token_quoted) {
+            // Checked first, so "200" stays a string
+            return make_token_string();
+        } else {
+            // Check if it's a number
+            // Digits never run past the token, which ends at a delimiter or quote
+            long num = strtol(interp->token, NULL, 10);
+            if (num != 0 || (interp->token_length == 1 && interp->token[0] == '0')) {
+                return make_number(num);
+            } else {
+                return make_token_symbol();
+            }
+        }
+    }
+}
+
+/* --- Primitives --- */
+
+Node *prim_arithmetic(Node **args, int arg_count) {
+    if (arg_count != 2) return error_node(ERR_ARITHMETIC_ARITY);
+    if (args[0]->type != NUMBER || args[1]->type != NUMBER) return error_node(ERR_NUMBER_TYPE);
+    return NULL;
+}
+
+Node *prim_add(Node **args, int arg_count) {
+    Node *error = prim_arithmetic(args, arg_count);
+    if (error) return error;
+    return make_number(args[0]->value.number + args[1]->value.number);
+}
+
+Node *prim_sub(Node **args, int arg_count) {
+    Node *error = prim_arithmetic(args, arg_count);
+    if (error) return error;
+    return make_number(args[0]->value.number - args[1]->value.number);
+}
+
+Node *prim_mul(Node **args, int arg_count) {
+    Node *error = prim_arithmetic(args, arg_count);
+    if (error) return error;
+    return make_number(args[0]->value.number * args[1]->value.number);
+}
+
+Node *prim_div(Node **args, int arg_count) {
+    Node *error = prim_arithmetic(args, arg_count);
+    if (error) return error;
+    if (args[1]->value.number == 0) return error_node(ERR_DIVISION_BY_ZERO);
+    return make_number(args[0]->value.number / args[1]->value.number);
+}
+
+Node *prim_comparison(Node **args, int arg_count) {
+    if (arg_count != 2) return error_node(ERR_COMPARISON_ARITY);
+    if (args[0]->type != NUMBER || args[1]->type != NUMBER) return error_node(ERR_NUMBER_TYPE);
+    return NULL;
+}
+
+Node *prim_lt(Node **args, int arg_count) {
+    Node *error = prim_comparison(args, arg_count);
+    if (error) return error;
+    return make_boolean(args[0]->value.number < args[1]->value.number);
+}
+
+Node *prim_gt(Node **args, int arg_count) {
+    Node *error = prim_comparison(args, arg_count);
+    if (error) return error;
+    return make_boolean(args[0]->value.number > args[1]->value.number);
+}
+
+Node *prim_eq(Node **args, int arg_count) {
+    if (arg_count == 2 && args[0]->type == STRING && args[1]->type == STRING) {
+        return make_boolean(string_equal(args[0], args[1]));
+    }
+    Node *error = prim_comparison(args, arg_count);
+    if (error) return error;
+    return make_boolean(args[0]->value.number == args[1]->value.number);
+}
+
+// Calls pass it errors, which other operators propagate instead of receiving
+Node *prim_error_p(Node **args, int arg_count) {
+    if (arg_count != 1) return error_node(ERR_ERROR_P_ARITY);
+    return make_boolean(args[0]->type == ERROR);
+}
+
+Node *prim_write(Node **args, int arg_count) {
+    if (arg_count != 1) return error_node(ERR_WRITE_ARITY);
+    print_node(args[0]);
+    out_char('\n');
+    out_end();
+    return make_boolean(1); // Return a value to continue the REPL
+}
+
+// Lazy sequences, defined with their primitives below. Each returns NULL
+// for an empty sequence.
+Node *seq_first(Node *seq);
+Node *seq_rest(Node *seq);
+
+Node *prim_first(Node **args, int arg_count) {
+    if (arg_count != 1) return error_node(ERR_FIRST_ARITY);
+    if (args[0]->type == SEQ) {
+        Node *first = seq_first(args[0]);
+        return first ? first : error_node(ERR_FIRST_EMPTY_SEQUENCE);
+    }
+    if (args[0]->type == VECTOR) {
+        if (args[0]->value.vector.length == 0) return error_node(ERR_FIRST_EMPTY_VECTOR);
+        return make_number(args[0]->value.vector.items[0]);
+    }
+    if (args[0]->type != LIST) return error_node(ERR_FIRST_TYPE);
+    if (args[0]->value.compound.child_count == 0) return error_node(ERR_FIRST_EMPTY);
+    return args[0]->value.compound.children[0];
+}
+
+Node *make_vector(int length) {
+    Node *vector = make_node(VECTOR);
+    vector->value.vector.items = node_data(vector, length * sizeof(long));
+    vector->value.vector.length = length;
+    return vector;
+}
+
+// `length` items of `vector` from `start`, shared rather than copied
+Node *make_vector_view(Node *vector, int start, int length) {
+    Node *view = make_node(VECTOR);
+    view->value.vector.items = vector->value.vector.items + start;
+    view->value.vector.length = length;
+    view->value.vector.owner = vector->value.vector.owner ? vector->value.vector.owner : vector;
+    return view;
+}
+
+// A list sharing `count` children starting at `children`, which belong to `owner`
+Node *make_slice(Node *owner, Node **children, int count) {
+    Node *slice = make_node(LIST);
+    slice->value.compound.children = children;
+    slice->value.compound.child_count = count;
+    slice->value.compound.owner = owner;
+    return slice;
+}
+
+// rest shares its argument's children instead of copying them
+Node *prim_rest(Node **args, int arg_count) {
+    if (arg_count != 1) return error_node(ERR_REST_ARITY);
+    if (args[0]->type == SEQ) {
+        Node *rest = seq_rest(args[0]);
+        return rest ? rest : error_node(ERR_REST_EMPTY_SEQUENCE);
+    }
+    if (args[0]->type == VECTOR) {
+        if (args[0]->value.vector.length == 0) return error_node(ERR_REST_EMPTY_VECTOR);
+        return make_vector_view(args[0], 1, args[0]->value.vector.length - 1);
+    }
+    if (args[0]->type != LIST) return error_node(ERR_REST_TYPE);
+    if (args[0]->value.compound.child_count == 0) return error_node(ERR_REST_EMPTY);
+    
+    Node *list = args[0];
+    if (list->flags & NODE_ARENA) {
+        // Parse-time lists do not outlive the line, so they cannot be shared
+        Node *new_list = make_compound_node(LIST, list->value.compound.child_count - 1);
+        memcpy(new_list->value.compound.children, list->value.compound.children + 1, (list->value.compound.child_count - 1) * sizeof(Node *));
+        return new_list;
+    }
+    Node *owner = list->value.compound.owner ? list->value.compound.owner : list;
+    return make_slice(owner, list->value.compound.children + 1, list->value.compound.child_count - 1);
+}
+
+// cons prepends into the free space in front of a list buffer when its
+// argument starts at the buffer's first element. Otherwise it copies into
+// a new buffer with room to grow, so repeated conses are amortized O(1).
+Node *prim_cons(Node **args, int arg_count) {
+    if (arg_count != 2) return error_node(ERR_CONS_ARITY);
+    if (args[1]->type != LIST) return error_node(ERR_CONS_TYPE);
+    Node *head = args[0];
+    Node *list = args[1];
+    int count = list->value.compound.child_count;
+    Node *buffer = list->value.compound.owner;
+    // Workers may share a buffer, so they always copy
+    if (!in_worker && buffer && buffer->type == LIST_BUFFER && buffer->value.buffer.start > 0 &&
+        list->value.compound.children == buffer->value.buffer.items + buffer->value.buffer.start) {
+        // A persistent buffer must not gain a reference into the parse arena
+        if (buffer->flags & NODE_PERSISTENT) head = persist(head);
+        buffer->value.buffer.items[--buffer->value.buffer.start] = head;
+        return make_slice(buffer, list->value.compound.children - 1, count + 1);
+    }
+
+    int capacity = (count + 1) * 2 < 8 ? 8 : (count + 1) * 2;
+    buffer = make_node(LIST_BUFFER);
+    buffer->value.buffer.items = node_data(buffer, capacity * sizeof(Node *));
+    buffer->value.buffer.capacity = capacity;
+    buffer->value.buffer.start = capacity - count - 1;
+    buffer->value.buffer.items[buffer->value.buffer.start] = head;
+    memcpy(buffer->value.buffer.items + buffer->value.buffer.start + 1, list->value.compound.children, count * sizeof(Node *));
+    return make_slice(buffer, buffer->value.buffer.items + buffer->value.buffer.start, count + 1);
+}
+
+Node *prim_strlen(Node **args, int arg_count) {
+    if (arg_count != 1) return error_node(ERR_STRLEN_ARITY);
+    if (args[0]->type != STRING) return error_node(ERR_STRLEN_TYPE);
+    return make_number(args[0]->value.str.length);
+}
+
+// concat builds a rope, so appending to a long string does not copy it
+Node *prim_concat(Node **args, int arg_count) {
+    for (int i = 0; i < arg_count; i++) {
+        if (args[i]->type != STRING) return error_node(ERR_CONCAT_TYPE);
+    }
+    if (arg_count == 0) return make_string("");
+    Node *result = args[0];
+    for (int i = 1; i < arg_count; i++) result = make_rope(result, args[i]);
+    return result;
+}
+
+// substr(s start) or substr(s start length), a view sharing s's chars
+Node *prim_substr(Node **args, int arg_count) {
+    if (arg_count != 2 && arg_count != 3) return error_node(ERR_SUBSTR_ARITY);
+    if (args[0]->type != STRING) return error_node(ERR_SUBSTR_TYPE);
+    if (args[1]->type != NUMBER || (arg_count == 3 && args[2]->type != NUMBER)) {
+        return error_node(ERR_SUBSTR_RANGE_TYPE);
+    }
+    long length = args[0]->value.str.length;
+    long start = args[1]->value.number;
+    long count = arg_count == 3 ? args[2]->value.number : length - start;
+    if (start < 0 || start > length || count < 0 || count > length - start) {
+        return error_node(ERR_SUBSTR_RANGE);
+    }
+    return make_string_view(args[0], start, count);
+}
+
+// split(s separator) is a list of views of the pieces between separators
+Node *prim_split(Node **args, int arg_count) {
+    if (arg_count != 2) return error_node(ERR_SPLIT_ARITY);
+    if (args[0]->type != STRING || args[1]->type != STRING) return error_node(ERR_SPLIT_TYPE);
+    int sep_length = args[1]->value.str.length;
+    if (sep_length == 0) return error_node(ERR_SPLIT_SEPARATOR);
+    Node *string = args[0];
+    int length = string->value.str.length;
+    if (!string->value.str.chars) {
+        // Flattened once for all the pieces; a worker's private copy becomes their base
+        char *flat = string_flatten(string);
+        if (in_worker) string = make_string_n(flat, length);
+    }
+    const char *chars = string->value.str.chars;
+    const char *sep = string_chars(args[1]);
+
+    int count = 1;
+    for (int i = 0; i + sep_length <= length;) {
+        if (memcmp(chars + i, sep, sep_length) == 0) {
+            count++;
+            i += sep_length;
+        } else {
+            i++;
+        }
+    }
+    Node *list = make_compound_node(LIST, count);
+    int start = 0, piece = 0;
+    for (int i = 0; i + sep_length <= length;) {
+        if (memcmp(chars + i, sep, sep_length) == 0) {
+            list->value.compound.children[piece++] = make_string_view(string, start, i - start);
+            i += sep_length;
+            start = i;
+        } else {
+            i++;
+        }
+    }
+    list->value.compound.children[piece] = make_string_view(string, start, length - start);
+    return list;
+}
+
+// Vector kernels. Arithmetic is unsigned, so sums wrap instead of overflowing.
+#if defined(__GNUC__)
+// Two longs at a time through the compiler's vector extensions: SSE2 or NEON,
+// or wider when built for AVX
+#define VECTOR_LANES 2
+typedef unsigned long Lanes __attribute__((vector_size(VECTOR_LANES * sizeof(long))));
+typedef long SignedLanes __attribute__((vector_size(VECTOR_LANES * sizeof(long))));
+
+static inline Lanes lanes_load(const long *p) {
+    Lanes lanes;
+    memcpy(&lanes, p, sizeof(lanes));
+    return lanes;
+}
+
+static inline void lanes_store(long *p, Lanes lanes) {
+    memcpy(p, &lanes, sizeof(lanes));
+}
+#else
+#define VECTOR_LANES 0
+#endif
+
+static long vector_sum(const long *a, int n) {
+    unsigned long sum = 0;
+    int i = 0;
+#if VECTOR_LANES
+    // Two accumulators keep consecutive adds independent
+    Lanes sum0 = { 0 }, sum1 = { 0 };
+    for (; i + 2 * VECTOR_LANES <= n; i += 2 * VECTOR_LANES) {
+        sum0 += lanes_load(a + i);
+        sum1 += lanes_load(a + i + VECTOR_LANES);
+    }
+    sum0 += sum1;
+    for (int lane = 0; lane < VECTOR_LANES; lane++) sum += sum0[lane];
+#endif
+    for (; i < n; i++) sum += a[i];
+    return sum;
+}
+
+static long vector_dot(const long *a, const long *b, int n) {
+    unsigned long sum = 0;
+    int i = 0;
+#if VECTOR_LANES
+    Lanes sum0 = { 0 }, sum1 = { 0 };
+    for (; i + 2 * VECTOR_LANES <= n; i += 2 * VECTOR_LANES) {
+        sum0 += lanes_load(a + i) * lanes_load(b + i);
+        sum1 += lanes_load(a + i + VECTOR_LANES) * lanes_load(b + i + VECTOR_LANES);
+    }
+    sum0 += sum1;
+    for (int lane = 0; lane < VECTOR_LANES; lane++) sum += sum0[lane];
+#endif
+    for (; i < n; i++) sum += (unsigned long)a[i] * b[i];
+    return sum;
+}
+
+// b is NULL to add k to every item
+static void vector_add(long *out, const long *a, const long *b, long k, int n) {
+    int i = 0;
+#if VECTOR_LANES
+    Lanes kk = (Lanes){ 0 } + (unsigned long)k;
+    for (; i + VECTOR_LANES <= n; i += VECTOR_LANES) {
+        lanes_store(out + i, lanes_load(a + i) + (b ? lanes_load(b + i) : kk));
+    }
+#endif
+    for (; i < n; i++) out[i] = (unsigned long)a[i] + (unsigned long)(b ? b[i] : k);
+}
+
+// 1 where a[i] op b[i] (or k) holds, else 0; op is OP_LT, OP_GT or OP_EQ
+static void vector_compare(long *out, Opcode op, const long *a, const long *b, long k, int n) {
+    int i = 0;
+#if VECTOR_LANES
+    SignedLanes kk = (SignedLanes){ 0 } + k;
+    for (; i + VECTOR_LANES <= n; i += VECTOR_LANES) {
+        SignedLanes x = (SignedLanes)lanes_load(a + i);
+        SignedLanes y = b ? (SignedLanes)lanes_load(b + i) : kk;
+        // Vector comparisons yield -1 for true
+        SignedLanes mask = op == OP_LT ? x < y : op == OP_GT ? x > y : x == y;
+        lanes_store(out + i, (Lanes)-mask);
+    }
+#endif
+    for (; i < n; i++) {
+        long y = b ? b[i] : k;
+        out[i] = op == OP_LT ? a[i] < y : op == OP_GT ? a[i] > y : a[i] == y;
+    }
+}
+
+// vector(n ...) or vector(list) packs numbers into a vector
+Node *prim_vector(Node **args, int arg_count) {
+    Node **items = args;
+    int count = arg_count;
+    if (arg_count == 1 && args[0]->type == LIST) {
+        items = args[0]->value.compound.children;
+        count = args[0]->value.compound.child_count;
+    }
+    for (int i = 0; i < count; i++) {
+        if (items[i]->type != NUMBER) return error_node(ERR_VECTOR_TYPE);
+    }
+    Node *vector = make_vector(count);
+    for (int i = 0; i < count; i++) vector->value.vector.items[i] = items[i]->value.number;
+    return vector;
+}
+
+Node *prim_vsum(Node **args, int arg_count) {
+    if (arg_count != 1) return error_node(ERR_VSUM_ARITY);
+    if (args[0]->type != VECTOR) return error_node(ERR_VSUM_TYPE);
+    return make_number(vector_sum(args[0]->value.vector.items, args[0]->value.vector.length));
+}
+
+Node *prim_vdot(Node **args, int arg_count) {
+    if (arg_count != 2) return error_node(ERR_VDOT_ARITY);
+    if (args[0]->type != VECTOR || args[1]->type != VECTOR) return error_node(ERR_VDOT_TYPE);
+    if (args[0]->value.vector.length != args[1]->value.vector.length) return error_node(ERR_VDOT_LENGTH);
+    return make_number(vector_dot(args[0]->value.vector.items, args[1]->value.vector.items, args[0]->value.vector.length));
+}
+
+// The second operand of an elementwise primitive: a vector as long as the
+// first, or a number applied to every item. Returns an error, or NULL.
+static Node *vector_operand(Node *a, Node *b, char *name, const long **items, long *k) {
+    if (a->type != VECTOR || (b->type != VECTOR && b->type != NUMBER)) {
+        return make_error_detail(ERR_VECTOR_OPERAND, name);
+    }
+    if (b->type == NUMBER) {
+        *items = NULL;
+        *k = b->value.number;
+    } else if (b->value.vector.length != a->value.vector.length) {
+        return make_error_detail(ERR_VECTOR_LENGTH, name);
+    } else {
+        *items = b->value.vector.items;
+        *k = 0;
+    }
+    return NULL;
+}
+
+Node *prim_vmap_add(Node **args, int arg_count) {
+    if (arg_count != 2) return error_node(ERR_VMAP_ADD_ARITY);
+    const long *b;
+    long k;
+    Node *error = vector_operand(args[0], args[1], "vmap+", &b, &k);
+    if (error) return error;
+    Node *result = make_vector(args[0]->value.vector.length);
+    vector_add(result->value.vector.items, args[0]->value.vector.items, b, k, args[0]->value.vector.length);
+    return result;
+}
+
+// vcmp(op a b) with op one of < > eq? is a 0/1 vector, so vsum counts the
+// matches and vdot with a sums them
+Node *prim_vcmp(Node **args, int arg_count) {
+    if (arg_count != 3) return error_node(ERR_VCMP_ARITY);
+    Node *op = args[0];
+    if (op->type != PRIMITIVE_OP || (op->value.prim.opcode != OP_LT && op->value.prim.opcode != OP_GT && op->value.prim.opcode != OP_EQ)) {
+        return error_node(ERR_VCMP_OPERATOR);
+    }
+    const long *b;
+    long k;
+    Node *error = vector_operand(args[1], args[2], "vcmp", &b, &k);
+    if (error) return error;
+    Node *result = make_vector(args[1]->value.vector.length);
+    vector_compare(result->value.vector.items, op->value.prim.opcode, args[1]->value.vector.items, b, k, args[1]->value.vector.length);
+    return result;
+}
+
+/* Lazy sequences */
+
+// range, map, filter and take build SEQ nodes that compute their elements
+// on demand. rest makes a new node for the rest of a sequence instead of
+// copying it, so a pipeline walked with first and rest runs in constant
+// memory. A computed head is cached in its node, which keeps the node's
+// value. Workers may share the node, so they do not cache, and neither do
+// image nodes, which the collector does not mark through.
+
+// Defined with the thread pool below
+Node *apply_function(Node *fn, Node **args, int arg_count);
+
+Node *make_range(long next, long end, long step) {
+    Node *range = make_node(SEQ);
+    range->value.seq.kind = SEQ_RANGE;
+    range->value.seq.next = next;
+    range->value.seq.end = end;
+    range->value.seq.step = step;
+    return range;
+}
+
+// A map, filter or take over `source`; `fn` is the function, or NULL for a take
+Node *make_derived_seq(SeqKind kind, Node *source, Node *fn, long count) {
+    Node *seq = make_node(SEQ);
+    seq->value.seq.kind = kind;
+    seq->value.seq.source = source;
+    if (kind == SEQ_TAKE) seq->value.seq.count = count;
+    else seq->value.seq.fn = fn;
+    return seq;
+}
+
+static int is_sequence(Node *node) {
+    return node->type == SEQ || node->type == LIST || node->type == VECTOR;
+}
+
+static int seq_caches(Node *seq) {
+    return !in_worker && !(seq->flags & NODE_STATIC);
+}
+
+// Stores a forced value in `seq`. A persistent sequence must not gain a
+// reference into the parse arena.
+static Node *seq_keep(Node *seq, Node *value) {
+    return seq->flags & NODE_PERSISTENT ? persist(value) : value;
+}
+
+// Finds a filter's first element, skipping those the predicate rejects, and
+// sets *at to its source positioned at that element. Returns NULL if none is
+// left, or an error.
+static Node *filter_first(Node *seq, Node **at) {
+    Node *source = seq->value.seq.source;
+    *at = source;
+    if (seq->value.seq.head) return seq->value.seq.head;
+    if (eval_sp + 2 > EVAL_STACK_MAX) return error_node(ERR_STACK_OVERFLOW);
+    // The position reached and the element tested stay rooted while the predicate runs
+    int base = eval_sp;
+    eval_stack[eval_sp++] = source;
+    Node *result;
+    for (;;) {
+        result = seq_first(source);
+        if (!result || result->type == ERROR) break;
+        eval_stack[base + 1] = result;
+        eval_sp = base + 2;
+        Node *keep = apply_function(seq->value.seq.fn, &eval_stack[base + 1], 1);
+        if (keep->type != BOOLEAN) {
+            result = keep->type == ERROR ? keep : error_node(ERR_FILTER_RESULT);
+            break;
+        }
+        if (keep->value.number) break;
+        eval_sp = base + 1;
+        source = seq_rest(source);
+        if (source->type == ERROR) {
+            result = source;
+            break;
+        }
+        eval_stack[base] = source;
+        // A predicate that is a primitive never reaches a safe point of its own
+        if (!gc_safe_point()) {
+            result = error_node(ERR_OUT_OF_MEMORY);
+            break;
+        }
+    }
+    eval_sp = base;
+    if (result && result->type == ERROR) return result;
+    *at = source;
+    // Skipped elements are dropped even when none matched, so the next look is quick
+    if (seq_caches(seq)) {
+        seq->value.seq.source = seq_keep(seq, source);
+        seq->value.seq.head = result ? seq_keep(seq, result) : NULL;
+    }
+    return result;
+}
+
+Node *seq_first(Node *seq) {
+    if (seq->type == LIST) return seq->value.compound.child_count ? seq->value.compound.children[0] : NULL;
+    if (seq->type == VECTOR) return seq->value.vector.length ? make_number(seq->value.vector.items[0]) : NULL;
+    switch (seq->value.seq.kind) {
+        case SEQ_RANGE: {
+            long next = seq->value.seq.next;
+            int more = seq->value.seq.step > 0 ? next < seq->value.seq.end : next > seq->value.seq.end;
+            return more ? make_number(next) : NULL;
+        }
+        case SEQ_TAKE:
+            return seq->value.seq.count > 0 ? seq_first(seq->value.seq.source) : NULL;
+        case SEQ_FILTER: {
+            Node *at;
+            return filter_first(seq, &at);
+        }
+        case SEQ_MAP: {
+            if (seq->value.seq.head) return seq->value.seq.head;
+            Node *item = seq_first(seq->value.seq.source);
+            if (!item || item->type == ERROR) return item;
+            if (eval_sp == EVAL_STACK_MAX) return error_node(ERR_STACK_OVERFLOW);
+            eval_stack[eval_sp++] = item; // Rooted while the function runs
+            Node *value = apply_function(seq->value.seq.fn, &eval_stack[eval_sp - 1], 1);
+            eval_sp--;
+            if (value->type != ERROR && seq_caches(seq)) seq->value.seq.head = seq_keep(seq, value);
+            return value;
+        }
+    }
+    return NULL;
+}
+
+Node *seq_rest(Node *seq) {
+    if (seq->type == LIST || seq->type == VECTOR) return seq_first(seq) ? prim_rest(&seq, 1) : NULL;
+    Node *rest;
+    switch (seq->value.seq.kind) {
+        case SEQ_RANGE:
+            if (!seq_first(seq)) return NULL;
+            return make_range(seq->value.seq.next + seq->value.seq.step, seq->value.seq.end, seq->value.seq.step);
+        case SEQ_TAKE:
+            if (seq->value.seq.count <= 0) return NULL;
+            rest = seq_rest(seq->value.seq.source);
+            if (!rest || rest->type == ERROR) return rest;
+            return make_derived_seq(SEQ_TAKE, rest, NULL, seq->value.seq.count - 1);
+        case SEQ_MAP:
+            rest = seq_rest(seq->value.seq.source);
+            if (!rest || rest->type == ERROR) return rest;
+            return make_derived_seq(SEQ_MAP, rest, seq->value.seq.fn, 0);
+        case SEQ_FILTER: {
+            Node *at;
+            Node *first = filter_first(seq, &at);
+            if (!first || first->type == ERROR) return first;
+            if (eval_sp == EVAL_STACK_MAX) return error_node(ERR_STACK_OVERFLOW);
+            eval_stack[eval_sp++] = at; // A worker's position is rooted nowhere else
+            rest = seq_rest(at);
+            eval_sp--;
+            if (!rest || rest->type == ERROR) return rest;
+            return make_derived_seq(SEQ_FILTER, rest, seq->value.seq.fn, 0);
+        }
+    }
+    return NULL;
+}
+
+// range(end), range(start end) or range(start end step)
+Node *prim_range(Node **args, int arg_count) {
+    if (arg_count < 1 || arg_count > 3) return error_node(ERR_RANGE_ARITY);
+    for (int i = 0; i < arg_count; i++) {
+        if (args[i]->type != NUMBER) return error_node(ERR_RANGE_TYPE);
+    }
+    long start = arg_count == 1 ? 0 : args[0]->value.number;
+    long end = args[arg_count == 1 ? 0 : 1]->value.number;
+    long step = arg_count == 3 ? args[2]->value.number : 1;
+    if (step == 0) return error_node(ERR_RANGE_STEP);
+    return make_range(start, end, step);
+}
+
+// Checks the function and source of map or filter
+static Node *derived_seq(SeqKind kind, Node *fn, Node *source, char *name) {
+    if (!is_function(fn)) return make_error_detail(ERR_SEQUENCE_FUNCTION, name);
+    if (!is_sequence(source)) return make_error_detail(ERR_SEQUENCE_SOURCE, name);
+    return make_derived_seq(kind, source, fn, 0);
+}
+
+Node *prim_map(Node **args, int arg_count) {
+    if (arg_count != 2) return error_node(ERR_MAP_ARITY);
+    return derived_seq(SEQ_MAP, args[0], args[1], "map");
+}
+
+Node *prim_filter(Node **args, int arg_count) {
+    if (arg_count != 2) return error_node(ERR_FILTER_ARITY);
+    return derived_seq(SEQ_FILTER, args[0], args[1], "filter");
+}
+
+Node *prim_take(Node **args, int arg_count) {
+    if (arg_count != 2) return error_node(ERR_TAKE_ARITY);
+    if (args[0]->type != NUMBER || args[0]->value.number < 0) return error_node(ERR_TAKE_COUNT);
+    if (!is_sequence(args[1])) return make_error_detail(ERR_SEQUENCE_SOURCE, "take");
+    return make_derived_seq(SEQ_TAKE, args[1], NULL, args[0]->value.number);
+}
+
+// Parallel primitives, defined with the thread pool below
+Node *prim_pmap(Node **args, int arg_count);
+Node *prim_pfilter(Node **args, int arg_count);
+Node *prim_preduce(Node **args, int arg_count);
+
+typedef struct {
+    char *name;
+    PrimitiveFn fn;
+} Primitive;
+
+// Indexed by Opcode
+static const Primitive primitives[OP_COUNT] = {
+    [OP_ADD]   = { "+",     prim_add },
+    [OP_SUB]   = { "-",     prim_sub },
+    [OP_MUL]   = { "*",     prim_mul },
+    [OP_DIV]   = { "/",     prim_div },
+    [OP_LT]    = { "<",     prim_lt },
+    [OP_GT]    = { ">",     prim_gt },
+    [OP_EQ]    = { "eq?",   prim_eq },
+    [OP_ERROR_P] = { "error?", prim_error_p },
+    [OP_WRITE] = { "write", prim_write },
+    [OP_FIRST] = { "first", prim_first },
+    [OP_REST]  = { "rest",  prim_rest },
+    [OP_CONS]  = { "cons",  prim_cons },
+    [OP_STRLEN] = { "strlen", prim_strlen },
+    [OP_CONCAT] = { "concat", prim_concat },
+    [OP_SUBSTR] = { "substr", prim_substr },
+    [OP_SPLIT]  = { "split",  prim_split },
+    [OP_VECTOR]   = { "vector", prim_vector },
+    [OP_VSUM]     = { "vsum",   prim_vsum },
+    [OP_VDOT]     = { "vdot",   prim_vdot },
+    [OP_VMAP_ADD] = { "vmap+",  prim_vmap_add },
+    [OP_VCMP]     = { "vcmp",   prim_vcmp },
+    [OP_RANGE]  = { "range",  prim_range },
+    [OP_MAP]    = { "map",    prim_map },
+    [OP_FILTER] = { "filter", prim_filter },
+    [OP_TAKE]   = { "take",   prim_take },
+    [OP_PMAP]    = { "pmap",    prim_pmap },
+    [OP_PFILTER] = { "pfilter", prim_pfilter },
+    [OP_PREDUCE] = { "preduce", prim_preduce },
+};
+
+Node *make_primitive_op(Opcode opcode) {
+    Node *node = make_node(PRIMITIVE_OP);
+    node->value.prim.name = primitives[opcode].name;
+    node->value.prim.opcode = opcode;
+    node->value.prim.fn = primitives[opcode].fn;
+    return node;
+}
+
+Node *make_host_primitive(char *name, ls_primitive host) {
+    Node *node = make_node(PRIMITIVE_OP);
+    node->value.prim.name = intern(name);
+    node->value.prim.opcode = OP_HOST;
+    node->value.prim.host = host;
+    return node;
+}
+
+// An error argument is the result of a call, except to error?
+static inline int accepts_errors(Node *op) {
+    return op->type == PRIMITIVE_OP && op->value.prim.opcode == OP_ERROR_P;
+}
+
+static inline Node *call_primitive(Node *op, Node **args, int arg_count) {
+    STAT(primitive_calls[op->value.prim.opcode]);
+    if (op->value.prim.opcode == OP_HOST) return op->value.prim.host(interp, args, arg_count);
+    return op->value.prim.fn(args, arg_count);
+}
+
+/* --- Resolver --- */
+
+// Compile-time mirror of a Frame: the names bound in one function body, and
+// the locals of enclosing functions it captures
+typedef struct Scope {
+    struct Scope *parent;
+    char **names;
+    Node **pending; // Per name, the local def that binds it until the resolver reaches that def
+    int count;
+    Node *captures; // ARGS node of LOCAL_REFs into the parent scope, built as they are found
+    Node **capture_refs; // References to captures, slotted once the body's own slots are known
+    int capture_ref_count;
+} Scope;
+
+int scope_add(Scope *scope, char *name) {
+    scope->names = realloc(scope->names, (scope->count + 1) * sizeof(char *));
+    scope->pending = realloc(scope->pending, (scope->count + 1) * sizeof(Node *));
+    scope->names[scope->count] = name;
+    scope->pending[scope->count] = NULL;
+    return scope->count++;
+}
+
+// Returns the slot of name among the scope's own, or -1
+static int scope_find(Scope *scope, char *name) {
+    for (int i = scope->count - 1; i >= 0; i--) {
+        if (scope->names[i] == name) return i;
+    }
+    return -1;
+}
+
+// Local defs rebind an existing slot of the same scope, like a new binding would shadow it
+int scope_define(Scope *scope, char *name) {
+    int slot = scope_find(scope, name);
+    if (slot < 0) return scope_add(scope, name);
+    scope->pending[slot] = NULL;
+    return slot;
+}
+
+// Binds the local defs directly in a function body before any of it is
+// resolved, so a def can refer to a sibling defined after it. Nested
+// function bodies get their own scope and are skipped.
+void scope_predeclare(Scope *scope, Node *expr) {
+    if (!expr) return;
+    switch (expr->type) {
+        case LIST:
+        case FUNCTION_CALL:
+        case IF:
+            for (int i = 0; i < expr->value.compound.child_count; i++) {
+                scope_predeclare(scope, expr->value.compound.children[i]);
+            }
+            break;
+        case DEF: {
+            Node *name = expr->value.compound.children[0];
+            if (expr->value.compound.child_count != 3) scope_predeclare(scope, expr->value.compound.children[1]);
+            if (name->type == SYMBOL && scope_find(scope, name->value.name) < 0) {
+                int slot = scope_add(scope, name->value.name);
+                scope->pending[slot] = expr;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void make_local_ref(Node *node, int slot) {
+    char *name = node->value.name;
+    node->type = LOCAL_REF;
+    node->value.ref.name = name;
+    node->value.ref.slot = slot;
+    node->value.ref.captured = 0;
+}
+
+static int resolve_local(Node *node, Scope *scope);
+
+// Returns 1 if scope or a scope around it binds name
+static int scope_binds(Scope *scope, char *name) {
+    for (; scope; scope = scope->parent) {
+        for (int i = 0; i < scope->count; i++) {
+            if (scope->names[i] == name) return 1;
+        }
+    }
+    return 0;
+}
+
+// Returns the index of name among the captures of scope, capturing it if an
+// enclosing function binds it, or -1 if none does
+static int scope_capture(Scope *scope, char *name) {
+    int count = scope->captures ? scope->captures->value.compound.child_count : 0;
+    for (int i = 0; i < count; i++) {
+        if (scope->captures->value.compound.children[i]->value.ref.name == name) return i;
+    }
+    if (!scope_binds(scope->parent, name)) return -1;
+    Node *ref = make_node(SYMBOL);
+    ref->value.name = name;
+    resolve_local(ref, scope->parent);
+    // A closure made before the def it captures runs gets the value when it does
+    int slot = scope_find(scope->parent, name);
+    if (slot >= 0 && scope->parent->pending[slot]) scope->parent->pending[slot]->flags |= NODE_LATE;
+    if (!scope->captures) scope->captures = make_compound_node(ARGS, 0);
+    append_child(scope->captures, ref);
+    return count;
+}
+
+// Rewrites node, a SYMBOL, into a LOCAL_REF if a function around it binds
+// the name. Returns 0 if the name is global.
+static int resolve_local(Node *node, Scope *scope) {
+    if (!scope) return 0;
+    char *name = node->value.name;
+    int slot = scope_find(scope, name);
+    if (slot >= 0) {
+        make_local_ref(node, slot);
+        return 1;
+    }
+    int capture = scope_capture(scope, name);
+    if (capture < 0) return 0;
+    make_local_ref(node, capture);
+    node->value.ref.captured = 1;
+    scope->capture_refs = realloc(scope->capture_refs, (scope->capture_ref_count + 1) * sizeof(Node *));
+    scope->capture_refs[scope->capture_ref_count++] = node;
+    return 1;
+}
+
+// Rewrites SYMBOL nodes that name a function's parameters or local defs into
+// LOCAL_REF frame slots. When a nested function's def runs, its closure
+// copies the enclosing locals the body uses, and each call puts them in the
+// slots after the function's own, so a function only reads its own frame.
+// Anything else stays a SYMBOL and is looked up in the global environment.
+void resolve(Node *expr, Scope *scope) {
+    if (!expr) return;
+    switch (expr->type) {
+        case SYMBOL:
+            resolve_local(expr, scope);
+            break;
+        case LIST:
+        case FUNCTION_CALL:
+        case IF:
+            for (int i = 0; i < expr->value.compound.child_count; i++) {
+                resolve(expr->value.compound.children[i], scope);
+            }
+            break;
+        case DEF: {
+            Node *name = expr->value.compound.children[0];
+            if (expr->value.compound.child_count == 3) {
+                // A nested function's result can depend on its parent's locals, so only
+                // top-level functions are memoized
+                if (scope) expr->flags &= ~(NODE_MEMO | NODE_CONST);
+                if (scope) make_local_ref(name, scope_define(scope, name->value.name));
+                Node *args_node = expr->value.compound.children[1];
+                Scope body_scope = { scope, NULL, NULL, 0, NULL, NULL, 0 };
+                scope_add(&body_scope, name->value.name);
+                for (int i = 0; i < args_node->value.compound.child_count; i++) {
+                    scope_add(&body_scope, args_node->value.compound.children[i]->value.name);
+                }
+                scope_predeclare(&body_scope, expr->value.compound.children[2]);
+                resolve(expr->value.compound.children[2], &body_scope);
+                // Captured values follow the function's own slots
+                for (int i = 0; i < body_scope.capture_ref_count; i++) {
+                    body_scope.capture_refs[i]->value.ref.slot += body_scope.count;
+                }
+                int captured = body_scope.captures ? body_scope.captures->value.compound.child_count : 0;
+                expr->value.compound.frame_size = body_scope.count + captured;
+                expr->value.compound.captures = body_scope.captures;
+                free(body_scope.names);
+                free(body_scope.pending);
+                free(body_scope.capture_refs);
+            } else {
+                expr->flags &= ~NODE_MEMO;
+                if (scope) expr->flags &= ~NODE_CONST;
+                resolve(expr->value.compound.children[1], scope);
+                if (scope) make_local_ref(name, scope_define(scope, name->value.name));
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/* --- Constant Folding --- */
+
+// Runs after the resolver, so any SYMBOL left names a global. Arithmetic and
+// comparisons on literal numbers are computed, an IF with a literal boolean
+// condition becomes the branch it takes, and constant globals (true, false
+// and defconsts) are inlined. The other built-ins can be redefined, so
+// references to them stay symbols. Anything that would fail at runtime is
+// left for eval to report.
+
+// A binding every instance starts with: a primitive under its own name, or true or false
+static int is_builtin(Binding *binding) {
+    Node *value = binding->value;
+    if (value->type == PRIMITIVE_OP) {
+        return value->value.prim.opcode < OP_COUNT && strcmp(binding->name, primitives[value->value.prim.opcode].name) == 0;
+    }
+    return value->type == BOOLEAN && strcmp(binding->name, value->value.number ? "true" : "false") == 0;
+}
+
+// The global binding of name while it still holds the built-in primitive, or NULL
+static Binding *builtin_binding(Env *env, char *name) {
+    if (!env->capacity) return NULL;
+    Binding *binding = env_find(env, name);
+    return binding->name && binding->value->type == PRIMITIVE_OP && is_builtin(binding) ? binding : NULL;
+}
+
+int is_call_form(Node *expr);
+
+// Primitives with no side effects, which may run at compile time
+static int is_pure_primitive(Node *node) {
+    if (node->type != PRIMITIVE_OP) return 0;
+    switch (node->value.prim.opcode) {
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+        case OP_LT: case OP_GT: case OP_EQ:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int is_literal(Node *node) {
+    return node->type == NUMBER || node->type == BOOLEAN || node->type == STRING;
+}
+
+Node *fold(Node *expr, Env *env);
+
+// Folds a call's children, then the call itself if its operator is pure and
+// its arguments are literals
+static Node *fold_call(Node *expr, Env *env) {
+    Node **children = expr->value.compound.children;
+    int count = expr->value.compound.child_count;
+    // The operator stays something callable, or the form would stop being a call
+    Node *op = fold(children[0], env);
+    if (op->type == PRIMITIVE_OP) children[0] = op;
+    // A value computed with a built-in, or from a call folded against one,
+    // is kept beside the call rather than replacing it, together with the
+    // built-ins whose rebinding retires it
+    Binding *builtin = children[0]->type == SYMBOL ? builtin_binding(env, children[0]->value.name) : NULL;
+    if (builtin) op = builtin->value;
+    unsigned deps = 0;
+    Node **args = malloc(count * sizeof(Node *));
+    int literal = 1;
+    for (int i = 1; i < count; i++) {
+        children[i] = fold(children[i], env);
+        Node *arg = children[i];
+        if (arg && (arg->type == LIST || arg->type == FUNCTION_CALL) && arg->value.compound.folded) {
+            deps |= arg->value.compound.fold_deps;
+            arg = arg->value.compound.folded;
+        }
+        args[i - 1] = arg;
+        if (!arg || (arg->type != NUMBER && arg->type != BOOLEAN)) literal = 0;
+    }
+    Node *result = literal && is_pure_primitive(op) ? op->value.prim.fn(args, count - 1) : NULL;
+    free(args);
+    if (!result || result->type == ERROR) return expr;
+    if (builtin) deps |= 1u << op->value.prim.opcode;
+    if (!deps) return result;
+    expr->value.compound.folded = result;
+    expr->value.compound.fold_deps = deps;
+    return expr;
+}
+
+// Returns the folded replacement for expr, rewriting its children in place
+Node *fold(Node *expr, Env *env) {
+    if (!expr) return expr;
+    Node **children = expr->value.compound.children;
+    switch (expr->type) {
+        case SYMBOL: {
+            Node *value = lookup_constant(env, expr->value.name);
+            return value && (is_literal(value) || value->type == PRIMITIVE_OP) ? value : expr;
+        }
+        case LIST: {
+            if (is_call_form(expr)) return fold_call(expr, env);
+            if (!expr->value.compound.child_count) return expr;
+            Node *head = children[0];
+            for (int i = 0; i < expr->value.compound.child_count; i++) children[i] = fold(children[i], env);
+            // Nor may a list of values turn into a call, as list(if true n 0) would
+            if (is_call_form(expr)) children[0] = head;
+            return expr;
+        }
+        case FUNCTION_CALL:
+            return expr->value.compound.child_count ? fold_call(expr, env) : expr;
+        case IF:
+            for (int i = 0; i < 3; i++) children[i] = fold(children[i], env);
+            if (children[0] && children[0]->type == BOOLEAN) return children[children[0]->value.number ? 1 : 2];
+            return expr;
+        case DEF:
+            // Child 0 is the name; a function's ARGS are not expressions
+            children[expr->value.compound.child_count - 1] = fold(children[expr->value.compound.child_count - 1], env);
+            return expr;
+        default:
+            return expr;
+    }
+}
+
+// `name` is interned. Scripts probe for optional bindings with error?, so
+// this only formats the message if it is printed.
+Node *undefined_symbol(char *name) {
+    return make_error_detail(ERR_UNDEFINED_SYMBOL, name);
+}
+
+Node *eval(Node *expr, Env *env, Frame *frame);
+
+// Non-tail evaluation recurses on the C stack; eval stops with an error
+// before it would overflow. Set up by init_stack_limit.
+#define STACK_RESERVE (256 * 1024)
+static _Thread_local char *stack_base = NULL;
+static _Thread_local size_t stack_limit = 0;
+
+void set_stack_limit(char *base, size_t size) {
+    stack_base = base;
+    stack_limit = size > 2 * STACK_RESERVE ? size - STACK_RESERVE : size / 2;
+}
+
+void init_stack_limit(char *base) {
+    struct rlimit rl;
+    size_t size = 8 * 1024 * 1024;
+    if (getrlimit(RLIMIT_STACK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) size = rl.rlim_cur;
+    set_stack_limit(base, size);
+}
+
+// A LIST whose head names a function is a call, e.g. list(fact list(- n 1))
+int is_call_form(Node *expr) {
+    if (expr->value.compound.child_count == 0) return 0;
+    NodeType head = expr->value.compound.children[0]->type;
+    return head == SYMBOL || head == LOCAL_REF || head == PRIMITIVE_OP;
+}
+
+// The frame for a call to a DEF already checked against its arity
+static inline Frame *push_call_frame(Node *func_def_node, Node **args, int arg_count, Frame *frame, Frame *owned) {
+    Frame *caller = frame;
+    Frame *reuse = NULL;
+    if (owned) {
+        caller = owned->caller;
+        if (owned->capacity >= func_def_node->value.compound.frame_size) {
+            reuse = owned;
+        } else if (frame_end(owned) == frame_chunk->data + frame_chunk->used) {
+            // Too small, but on top of the stack: pop it so the new frame takes its place
+            frame_pop_to((char *)owned);
+        }
+    }
+
+    // Slot 0 holds the function itself for recursion, then the parameters
+    Frame *local_frame = make_frame(func_def_node, caller, reuse);
+    for (int i = 0; i < arg_count; i++) {
+        local_frame->slots[i + 1] = args[i];
+    }
+    return local_frame;
+}
+
+// Builds the frame for a call to a user-defined function, a DEF or a
+// closure, with already-evaluated arguments. `owned` is a frame the caller is
+// done with (the frame of a function making a tail call) that may be reused
+// or dropped from the chain. Returns NULL and sets `error` on failure.
+Frame *enter_function(Node *fn, Node **args, int arg_count, Frame *frame, Frame *owned, Node **error) {
+    Node *func_def_node = function_def(fn);
+    Node *args_node = func_def_node->value.compound.children[1];
+    
+    if (args_node->value.compound.child_count != arg_count) {
+        *error = error_node(ERR_ARITY);
+        return NULL;
+    }
+
+    Frame *callee = push_call_frame(func_def_node, args, arg_count, frame, owned);
+    if (fn->type == CLOSURE) {
+        // The closure stands for the function in its own body, and its values fill the last slots
+        int count = fn->value.closure.count;
+        callee->slots[0] = fn;
+        memcpy(&callee->slots[callee->count - count], fn->value.closure.values, count * sizeof(Node *));
+    }
+    return callee;
+}
+
+
+// Evaluates expr. Calls in tail position (a function body, the branches of
+// an IF, a call form) loop here instead of recursing, so a tail-recursive
+// function runs in constant C stack and reuses its frame.
+Node *eval_loop(Node *expr, Env *env, Frame *frame) {
+    int entry_sp = eval_sp;
+    Frame *owned = NULL;
+    for (;;) {
+        if (!expr) return NULL;
+        // A LIST is counted once it is known to be a data list or a call
+        if (expr->type != LIST) STAT(nodes[expr->type]);
+        switch (expr->type) {
+            case SYMBOL: {
+                Node *result = lookup(env, expr->value.name);
+                if (!result) return undefined_symbol(expr->value.name);
+                return result;
+            }
+            case LOCAL_REF: {
+                STAT(local_lookups);
+                Node *result = frame->slots[expr->value.ref.slot];
+                if (result) return result;
+                if (expr->value.ref.captured) return make_error_detail(ERR_UNBOUND_CAPTURE, expr->value.ref.name);
+                // A local def that has not run yet falls back to the global binding
+                result = lookup(env, expr->value.ref.name);
+                if (!result) return undefined_symbol(expr->value.ref.name);
+                return result;
+            }
+            case NUMBER:
+            case BOOLEAN:
+            case ERROR:
+            case STRING:
+            case VECTOR:
+            case SEQ:
+            case PRIMITIVE_OP:
+            case DATA:
+                return expr;
+            case LIST: {
+                // A call form has the same layout as a FUNCTION_CALL, so it is evaluated in place
+                if (is_call_form(expr)) {
+                    STAT(nodes[FUNCTION_CALL]);
+                    goto call;
+                } else {
+                    STAT(nodes[LIST]);
+                    // It's a data list, evaluate its children; the list stays rooted while they run
+                    if (eval_sp == EVAL_STACK_MAX) return error_node(ERR_STACK_OVERFLOW);
+                    Node *new_list = make_compound_node(LIST, expr->value.compound.child_count);
+                    eval_stack[eval_sp++] = new_list;
+                    for (int i = 0; i < expr->value.compound.child_count; i++) {
+                        new_list->value.compound.children[i] = eval(expr->value.compound.children[i], env, frame);
+                        if (new_list->value.compound.children[i]->type == ERROR) {
+                            eval_sp--;
+                            return new_list->value.compound.children[i];
+                        }
+                    }
+                    eval_sp--;
+                    return new_list;
+                }
+            }
+            case FUNCTION_CALL: {
+                if (expr->value.compound.child_count == 0) return make_compound_node(LIST, 0);
+            call:
+                if (expr->value.compound.folded && !(expr->value.compound.fold_deps & env->rebound_ops)) return expr->value.compound.folded;
+                if (!gc_safe_point()) return error_node(ERR_OUT_OF_MEMORY);
+                if (eval_sp + expr->value.compound.child_count > EVAL_STACK_MAX) return error_node(ERR_STACK_OVERFLOW);
+            
+                // The operator and arguments are kept on the eval stack so they stay rooted
+                int base = eval_sp;
+                Node *op = eval(expr->value.compound.children[0], env, frame);
+                if (op->type == ERROR) return op;
+                eval_stack[eval_sp++] = op;
+
+                // Collect and evaluate arguments
+                for (int i = 1; i < expr->value.compound.child_count; i++) {
+                    Node *arg = eval(expr->value.compound.children[i], env, frame);
+                    if (arg->type == ERROR && !accepts_errors(op)) {
+                        eval_sp = base;
+                        return arg;
+                    }
+                    eval_stack[eval_sp++] = arg;
+                }
+                Node **args = &eval_stack[base + 1];
+                int arg_count = expr->value.compound.child_count - 1;
+
+                Node *result;
+                if (op->type == PRIMITIVE_OP) {
+                    if (profiling) profile_enter(op->value.prim.name, NULL);
+                    result = call_primitive(op, args, arg_count);
+                    if (profiling) profile_exit();
+                } else if (op->type == DEF && (op->flags & NODE_MEMO)) {
+                    // Not a tail call: the result is cached once the body returns
+                    unsigned long hash = memo_key_hash(op, args, arg_count);
+                    result = memo_find(op, args, arg_count, hash);
+                    if (!result) {
+                        Frame *callee = enter_function(op, args, arg_count, frame, NULL, &result);
+                        if (callee) {
+                            if (profiling) profile_enter(op->value.compound.children[0]->value.name, callee);
+                            active_frame = callee;
+                            result = eval(op->value.compound.children[2], env, callee);
+                            if (profiling) profile_exit();
+                            memo_store(op, args, arg_count, hash, result);
+                        }
+                    }
+                } else if (op->type == DEF || op->type == CLOSURE) {
+                    // Tail call: continue with the body in the new frame, which now holds the arguments
+                    Frame *callee = enter_function(op, args, arg_count, frame, owned, &result);
+                    if (callee) {
+                        Node *def = function_def(op);
+                        if (profiling) {
+                            // The function making the tail call is finished
+                            if (owned) profile_exit();
+                            profile_enter(def->value.compound.children[0]->value.name, callee);
+                        }
+                        eval_sp = entry_sp;
+                        active_frame = frame = owned = callee;
+                        expr = def->value.compound.children[2];
+                        continue;
+                    }
+                } else {
+                    result = error_node(ERR_NOT_A_FUNCTION);
+                }
+                eval_sp = base;
+                return result;
+            }
+            case DEF: {
+                Node *name = expr->value.compound.children[0];
+            
+                // This now handles both function and variable definitions
+                if (expr->value.compound.child_count == 3) {
+                     // It's a function definition, store the entire DEF node, or its closure
+                     if (name->type == LOCAL_REF) {
+                         Node *closure = make_closure(expr, frame);
+                         frame->slots[name->value.ref.slot] = closure;
+                         if (expr->flags & NODE_LATE) patch_captures(frame, name->value.ref.slot, closure);
+                     }
+                     else if (!bind_global(env, name->value.name, persist(expr), expr->flags & NODE_CONST)) return constant_error(name->value.name);
+                     return make_boolean(1); // Return a value to signify success
+                } else {
+                     // It's a simple variable assignment
+                     Node *value = expr->value.compound.children[1];
+                     Node *evaluated_value = eval(value, env, frame);
+                     if (name->type == LOCAL_REF) {
+                         frame->slots[name->value.ref.slot] = evaluated_value;
+                         if (expr->flags & NODE_LATE) patch_captures(frame, name->value.ref.slot, evaluated_value);
+                     }
+                     else if (!bind_global(env, name->value.name, persist(evaluated_value), expr->flags & NODE_CONST)) return constant_error(name->value.name);
+                     return evaluated_value;
+                }
+            }
+            case IF: {
+                Node *condition = expr->value.compound.children[0];
+                Node *true_branch = expr->value.compound.children[1];
+                Node *false_branch = expr->value.compound.children[2];
+            
+                Node *condition_result = eval(condition, env, frame);
+                if (condition_result->type == ERROR) return condition_result;
+            
+                if (condition_result && condition_result->type == BOOLEAN) {
+                    expr = condition_result->value.number != 0 ? true_branch : false_branch;
+                    continue;
+                } else {
+                     return error_node(ERR_IF_CONDITION);
+                }
+            }
+            default:
+                return error_node(ERR_BAD_EXPRESSION);
+        }
+    }
+}
+
+static _Thread_local long eval_depth = 0;
+
+// Frames and eval stack entries created by a call are released on return
+Node *eval(Node *expr, Env *env, Frame *frame) {
+    char here;
+    if ((size_t)(stack_base - &here) > stack_limit) return error_node(ERR_RECURSION_DEPTH);
+    int entry_sp = eval_sp;
+    eval_depth++;
+    STAT_MAX(max_depth, eval_depth);
+    Node *result = eval_loop(expr, env, frame);
+    eval_depth--;
+    eval_sp = entry_sp;
+    active_frame = frame;
+    frame_pop_to(frame_end(frame));
+    if (profiling) profile_unwind(frame);
+    return result;
+}
+
+/* --- Bytecode Compiler and VM --- */
+
+// The default evaluator compiles each top-level expression, and each
+// function body on its first call, into a flat array of words: an
+// instruction followed by its operands. The VM runs it on the eval stack,
+// with its own return stack instead of C recursion. eval() above remains as
+// the reference tree-walker (--tree-walk), and both share frames, the
+// globals and the primitive table, so they produce the same results.
+typedef enum {
+    BC_CONST,          // node: push node
+    BC_GLOBAL,         // name epoch value: push the global binding of name, cached while epoch is current
+    BC_LOCAL,          // slot name captured: push a frame slot
+    BC_CLOSURE,        // def: push the value of a nested function definition
+    BC_DEF_GLOBAL,     // name flags: bind name to the top of stack, leaving it there
+    BC_DEF_LOCAL,      // slot late: store the top of stack in a frame slot, leaving it there
+    BC_POP,            // discard the top of stack
+    BC_LIST,           // n: pop n values, push a list of them
+    BC_BRANCH,         // else end: pop a condition, jump to else if false
+    BC_JUMP,           // target
+    BC_FOLDED,         // value deps end: push the value of a folded call and jump past it, unless one of deps was rebound
+    BC_CALL,           // argc global epoch: pop an operator and argc arguments, push the result
+    BC_TAIL_CALL,      // argc: like CALL, but replaces the current function
+    BC_RETURN,         // pop the result and return from the current function
+    BC_HALT,           // pop the result and stop
+    BC_COUNT
+} BytecodeOp;
+
+// BC_DEF_GLOBAL flags. A failed definition leaves an error instead.
+#define DEF_CONSTANT   1 // Bind a defconst
+#define DEF_YIELD_TRUE 2 // Leave true, the value of a function definition
+
+typedef struct Code {
+    int max_stack;          // Eval stack entries the code needs at most
+    intptr_t words[];
+} Code;
+
+// Growable buffer used while compiling
+typedef struct Compiler {
+    intptr_t *words;
+    int count;
+    int capacity;
+    int depth;
+    int max_depth;
+} Compiler;
+
+void emit(Compiler *c, intptr_t word) {
+    if (c->count == c->capacity) {
+        c->capacity = c->capacity ? c->capacity * 2 : 64;
+        c->words = realloc(c->words, c->capacity * sizeof(intptr_t));
+    }
+    c->words[c->count++] = word;
+}
+
+// Tracks how many eval stack entries the instructions emitted so far use
+void stack_effect(Compiler *c, int delta) {
+    c->depth += delta;
+    if (c->depth > c->max_depth) c->max_depth = c->depth;
+}
+
+
+void compile_expr(Compiler *c, Node *expr, int tail);
+
+// Inline caches live in the code words, which pmap workers share. They are
+// only filled with the bindings of the current epoch, which workers cannot
+// change, so racing fills store the same values.
+#define CACHE_LOAD(word) __atomic_load_n(&(word), __ATOMIC_ACQUIRE)
+#define CACHE_STORE(word, value) __atomic_store_n(&(word), (value), __ATOMIC_RELEASE)
+
+// A call whose operator is a global gets the offset of that BC_GLOBAL, and
+// caches the epoch in which the function it found passed the arity check
+void compile_call(Compiler *c, Node *expr, int tail) {
+    int count = expr->value.compound.child_count;
+    int end_operand = -1;
+    if (expr->value.compound.folded) {
+        emit(c, BC_FOLDED);
+        emit(c, (intptr_t)expr->value.compound.folded);
+        emit(c, expr->value.compound.fold_deps);
+        end_operand = c->count;
+        emit(c, 0);
+    }
+    intptr_t global = expr->value.compound.children[0]->type == SYMBOL ? c->count : -1;
+    for (int i = 0; i < count; i++) compile_expr(c, expr->value.compound.children[i], 0);
+    emit(c, tail ? BC_TAIL_CALL : BC_CALL);
+    emit(c, count - 1);
+    emit(c, global);
+    emit(c, 0);
+    stack_effect(c, 1 - count);
+    if (end_operand >= 0) c->words[end_operand] = c->count;
+}
+
+// Compiles expr to push its value. `tail` is set in the tail position of a
+// function body, where calls become BC_TAIL_CALL.
+void compile_expr(Compiler *c, Node *expr, int tail) {
+    if (!expr) {
+        emit(c, BC_CONST);
+        emit(c, 0);
+        stack_effect(c, 1);
+        return;
+    }
+    switch (expr->type) {
+        case SYMBOL:
+            emit(c, BC_GLOBAL);
+            emit(c, (intptr_t)expr->value.name);
+            emit(c, 0);
+            emit(c, 0);
+            stack_effect(c, 1);
+            break;
+        case LOCAL_REF:
+            emit(c, BC_LOCAL);
+            emit(c, expr->value.ref.slot);
+            emit(c, (intptr_t)expr->value.ref.name);
+            emit(c, expr->value.ref.captured);
+            stack_effect(c, 1);
+            break;
+        case NUMBER:
+        case BOOLEAN:
+        case ERROR:
+        case STRING:
+        case VECTOR:
+        case SEQ:
+        case PRIMITIVE_OP:
+        case DATA:
+            emit(c, BC_CONST);
+            emit(c, (intptr_t)expr);
+            stack_effect(c, 1);
+            break;
+        case LIST:
+            if (is_call_form(expr)) {
+                compile_call(c, expr, tail);
+            } else {
+                for (int i = 0; i < expr->value.compound.child_count; i++) {
+                    compile_expr(c, expr->value.compound.children[i], 0);
+                }
+                emit(c, BC_LIST);
+                emit(c, expr->value.compound.child_count);
+                stack_effect(c, 1 - expr->value.compound.child_count);
+            }
+            break;
+        case FUNCTION_CALL:
+            if (expr->value.compound.child_count == 0) {
+                emit(c, BC_LIST);
+                emit(c, 0);
+                stack_effect(c, 1);
+            } else {
+                compile_call(c, expr, tail);
+            }
+            break;
+        case IF: {
+            compile_expr(c, expr->value.compound.children[0], 0);
+            emit(c, BC_BRANCH);
+            int else_operand = c->count;
+            emit(c, 0);
+            int end_operand = c->count;
+            emit(c, 0);
+            stack_effect(c, -1);
+            compile_expr(c, expr->value.compound.children[1], tail);
+            emit(c, BC_JUMP);
+            int jump_operand = c->count;
+            emit(c, 0);
+            c->words[else_operand] = c->count;
+            stack_effect(c, -1);
+            compile_expr(c, expr->value.compound.children[2], tail);
+            c->words[end_operand] = c->count;
+            c->words[jump_operand] = c->count;
+            break;
+        }
+        case DEF: {
+            Node *name = expr->value.compound.children[0];
+            if (expr->value.compound.child_count == 3) {
+                // A function definition binds the DEF node itself, or its closure, and yields true
+                emit(c, expr->value.compound.captures ? BC_CLOSURE : BC_CONST);
+                emit(c, (intptr_t)expr);
+                stack_effect(c, 1);
+            } else {
+                compile_expr(c, expr->value.compound.children[1], 0);
+            }
+            if (name->type == LOCAL_REF) {
+                emit(c, BC_DEF_LOCAL);
+                emit(c, name->value.ref.slot);
+                emit(c, (expr->flags & NODE_LATE) != 0);
+                if (expr->value.compound.child_count == 3) {
+                    emit(c, BC_POP);
+                    emit(c, BC_CONST);
+                    emit(c, (intptr_t)make_boolean(1));
+                }
+            } else {
+                emit(c, BC_DEF_GLOBAL);
+                emit(c, (intptr_t)name->value.name);
+                emit(c, (expr->flags & NODE_CONST ? DEF_CONSTANT : 0) | (expr->value.compound.child_count == 3 ? DEF_YIELD_TRUE : 0));
+            }
+            break;
+        }
+        default:
+            emit(c, BC_CONST);
+            emit(c, (intptr_t)error_node(ERR_BAD_EXPRESSION));
+            stack_effect(c, 1);
+            break;
+    }
+}
+
+// Code for arena nodes lives in the parse arena; code for heap DEFs is
+// malloc'd and freed when the DEF is collected
+Code *finish_code(Compiler *c, int in_arena) {
+    size_t size = sizeof(Code) + c->count * sizeof(intptr_t);
+    Code *code = in_arena ? arena_alloc(&interp->ast_arena, size) : malloc(size);
+    code->max_stack = c->max_depth;
+    memcpy(code->words, c->words, c->count * sizeof(intptr_t));
+    free(c->words);
+    return code;
+}
+
+Code *compile_toplevel(Node *expr, int in_arena) {
+    Compiler c = { 0 };
+    compile_expr(&c, expr, 0);
+    emit(&c, BC_HALT);
+    return finish_code(&c, in_arena);
+}
+
+// pmap workers may compile the same function at once
+static pthread_mutex_t compile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+Code *compile_function(Node *func_def_node) {
+    Code *code = __atomic_load_n(&func_def_node->value.compound.code, __ATOMIC_ACQUIRE);
+    if (code) return code;
+    pthread_mutex_lock(&compile_lock);
+    code = func_def_node->value.compound.code;
+    if (!code) {
+        Compiler c = { 0 };
+        compile_expr(&c, func_def_node->value.compound.children[2], 1);
+        emit(&c, BC_RETURN);
+        code = finish_code(&c, func_def_node->flags & NODE_ARENA);
+        __atomic_store_n(&func_def_node->value.compound.code, code, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&compile_lock);
+    return code;
+}
+
+// Return stack entry for a non-tail call
+typedef struct VmReturn {
+    Code *code;
+    intptr_t *ip;
+    Frame *frame;
+    Frame *owned;
+    int memo_base; // For a defmemo call, where its operator and arguments sit on the stack; else -1
+    unsigned long memo_hash;
+} VmReturn;
+
+#define VM_RETURN_MAX (1024 * 1024)
+static _Thread_local VmReturn *vm_returns = NULL; // VM_RETURN_MAX entries
+static _Thread_local int vm_rp = 0;
+
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO 1
+#endif
+
+// Runs code until it halts, or until the function it starts in returns.
+// `owned` is the frame of that function, or NULL for top-level code.
+Node *vm_run(Code *code, Env *env, Frame *frame, Frame *owned) {
+    int entry_sp = eval_sp;
+    int entry_rp = vm_rp;
+    Frame *entry_frame = frame;
+    intptr_t *ip = code->words;
+    Node *result;
+    if (eval_sp + code->max_stack > EVAL_STACK_MAX) return error_node(ERR_STACK_OVERFLOW);
+
+#ifdef VM_COMPUTED_GOTO
+    static void *dispatch[BC_COUNT] = {
+        [BC_CONST] = &&do_const, [BC_GLOBAL] = &&do_global, [BC_LOCAL] = &&do_local, [BC_CLOSURE] = &&do_closure,
+        [BC_DEF_GLOBAL] = &&do_def_global, [BC_DEF_LOCAL] = &&do_def_local,
+        [BC_POP] = &&do_pop, [BC_LIST] = &&do_list, [BC_BRANCH] = &&do_branch, [BC_JUMP] = &&do_jump,
+        [BC_FOLDED] = &&do_folded,
+        [BC_CALL] = &&do_call, [BC_TAIL_CALL] = &&do_tail_call,
+        [BC_RETURN] = &&do_return, [BC_HALT] = &&do_halt,
+    };
+#define DISPATCH() goto *dispatch[*ip++]
+#define CASE(op) do_##op
+#else
+#define DISPATCH() goto dispatch_switch
+#define CASE(op) case BC_##op
+#endif
+#define PUSH(node) (eval_stack[eval_sp++] = (node))
+
+    DISPATCH();
+#ifndef VM_COMPUTED_GOTO
+dispatch_switch:
+    switch (*ip++) {
+#endif
+
+    CASE(const):
+        if (ip[0]) STAT(nodes[((Node *)ip[0])->type]);
+        PUSH((Node *)ip[0]);
+        ip += 1;
+        DISPATCH();
+
+    CASE(global): {
+        Node *value;
+        STAT(nodes[SYMBOL]);
+        if (CACHE_LOAD(ip[1]) == env->epoch) {
+            value = (Node *)CACHE_LOAD(ip[2]);
+        } else if ((value = lookup(env, (char *)ip[0]))) {
+            CACHE_STORE(ip[2], (intptr_t)value);
+            CACHE_STORE(ip[1], env->epoch);
+        } else {
+            value = undefined_symbol((char *)ip[0]);
+        }
+        PUSH(value);
+        ip += 3;
+        DISPATCH();
+    }
+
+    CASE(local): {
+        STAT(nodes[LOCAL_REF]);
+        STAT(local_lookups);
+        Node *value = frame->slots[ip[0]];
+        if (!value) {
+            // A local def that has not run yet falls back to the global binding
+            if (ip[2]) value = make_error_detail(ERR_UNBOUND_CAPTURE, (char *)ip[1]);
+            else if (!(value = lookup(env, (char *)ip[1]))) value = undefined_symbol((char *)ip[1]);
+        }
+        PUSH(value);
+        ip += 3;
+        DISPATCH();
+    }
+
+    CASE(closure):
+        STAT(nodes[DEF]);
+        PUSH(make_closure((Node *)ip[0], frame));
+        ip += 1;
+        DISPATCH();
+
+    CASE(def_global): {
+        Node *value = eval_stack[eval_sp - 1];
+        STAT(nodes[DEF]);
+        if (!bind_global(env, (char *)ip[0], persist(value), ip[1] & DEF_CONSTANT)) {
+            eval_stack[eval_sp - 1] = constant_error((char *)ip[0]);
+        } else if (ip[1] & DEF_YIELD_TRUE) {
+            eval_stack[eval_sp - 1] = make_boolean(1);
+        }
+        ip += 2;
+        DISPATCH();
+    }
+
+    CASE(def_local):
+        STAT(nodes[DEF]);
+        frame->slots[ip[0]] = eval_stack[eval_sp - 1];
+        if (ip[1]) patch_captures(frame, ip[0], eval_stack[eval_sp - 1]);
+        ip += 2;
+        DISPATCH();
+
+    CASE(pop):
+        eval_sp--;
+        DISPATCH();
+
+    CASE(list): {
+        intptr_t count = ip[0];
+        STAT(nodes[LIST]);
+        ip += 1;
+        Node **items = &eval_stack[eval_sp - count];
+        Node *list = NULL;
+        for (intptr_t i = 0; i < count; i++) {
+            if (items[i]->type == ERROR) {
+                list = items[i];
+                break;
+            }
+        }
+        if (!list) {
+            list = make_compound_node(LIST, count);
+            memcpy(list->value.compound.children, items, count * sizeof(Node *));
+        }
+        eval_sp -= count;
+        PUSH(list);
+        DISPATCH();
+    }
+
+    CASE(branch): {
+        Node *condition = eval_stack[--eval_sp];
+        STAT(nodes[IF]);
+        if (condition->type == BOOLEAN) {
+            ip = condition->value.number != 0 ? ip + 2 : code->words + ip[0];
+            DISPATCH();
+        }
+        PUSH(condition->type == ERROR ? condition : error_node(ERR_IF_CONDITION));
+        ip = code->words + ip[1];
+        DISPATCH();
+    }
+
+    CASE(jump):
+        ip = code->words + ip[0];
+        DISPATCH();
+
+    CASE(folded):
+        if (ip[1] & env->rebound_ops) {
+            ip += 3;
+        } else {
+            PUSH((Node *)ip[0]);
+            ip = code->words + ip[2];
+        }
+        DISPATCH();
+
+    CASE(call):
+    CASE(tail_call): {
+        int tail = ip[-1] == BC_TAIL_CALL;
+        int arg_count = ip[0];
+        intptr_t *site = ip;
+        ip += 3;
+        int base = eval_sp - arg_count - 1;
+        Node *op = eval_stack[base];
+        Node **args = &eval_stack[base + 1];
+        STAT(nodes[FUNCTION_CALL]);
+
+        result = NULL;
+        if (!gc_safe_point()) result = error_node(ERR_OUT_OF_MEMORY);
+        else if (op->type == ERROR) result = op;
+        else if (!accepts_errors(op)) {
+            for (int i = 0; i < arg_count; i++) {
+                if (args[i]->type == ERROR) {
+                    result = args[i];
+                    break;
+                }
+            }
+        }
+        if (!result) {
+            if (op->type == PRIMITIVE_OP) {
+                if (profiling) profile_enter(op->value.prim.name, NULL);
+                result = call_primitive(op, args, arg_count);
+                if (profiling) profile_exit();
+            } else if (op->type == DEF || op->type == CLOSURE) {
+                Node *def = function_def(op);
+                int memo = op->flags & NODE_MEMO;
+                unsigned long memo_hash = 0;
+                if (memo) {
+                    memo_hash = memo_key_hash(op, args, arg_count);
+                    result = memo_find(op, args, arg_count, memo_hash);
+                    // A miss is never a tail call; the result is cached when it returns
+                    tail = 0;
+                }
+                // The operator's BC_GLOBAL words, and the epoch this site last checked it in.
+                // A site checked in this epoch has its BC_GLOBAL filled in this epoch too.
+                intptr_t *global = site[1] >= 0 ? code->words + site[1] : NULL;
+                intptr_t *checked = &site[2];
+                int cached = global && CACHE_LOAD(*checked) == env->epoch && op == (Node *)CACHE_LOAD(global[3]);
+                Frame *callee = NULL;
+                if (!result && cached) {
+                    callee = push_call_frame(op, args, arg_count, frame, tail ? owned : NULL);
+                } else if (!result) {
+                    callee = enter_function(op, args, arg_count, frame, tail ? owned : NULL, &result);
+                    // Closures are not cached, since their values are copied in on each call
+                    if (callee && global && op->type == DEF && CACHE_LOAD(global[2]) == env->epoch &&
+                        op == (Node *)CACHE_LOAD(global[3])) {
+                        CACHE_STORE(*checked, env->epoch);
+                    }
+                }
+                if (callee) {
+                    Code *callee_code = compile_function(def);
+                    // A memoized call keeps its operator and arguments on the stack as the cache key
+                    eval_sp = memo ? base + 1 + arg_count : base;
+                    if (eval_sp + callee_code->max_stack > EVAL_STACK_MAX) {
+                        result = error_node(ERR_STACK_OVERFLOW);
+                        goto unwind;
+                    }
+                    if (!tail) {
+                        if (vm_rp == VM_RETURN_MAX) {
+                            result = error_node(ERR_RECURSION_DEPTH);
+                            goto unwind;
+                        }
+                        vm_returns[vm_rp++] = (VmReturn){ code, ip, frame, owned, memo ? base : -1, memo_hash };
+                        STAT_MAX(max_depth, vm_rp);
+                    }
+                    if (profiling) {
+                        if (tail && owned) profile_exit();
+                        profile_enter(def->value.compound.children[0]->value.name, callee);
+                    }
+                    code = callee_code;
+                    ip = code->words;
+                    active_frame = frame = owned = callee;
+                    DISPATCH();
+                }
+            } else {
+                result = error_node(ERR_NOT_A_FUNCTION);
+            }
+        }
+        eval_sp = base;
+        if (tail) goto return_result;
+        PUSH(result);
+        DISPATCH();
+    }
+
+    CASE(return):
+        result = eval_stack[--eval_sp];
+    return_result:
+        if (vm_rp == entry_rp) goto finish;
+        {
+            VmReturn *ret = &vm_returns[--vm_rp];
+            if (profiling) profile_exit();
+            if (ret->memo_base >= 0) {
+                Node *fn = eval_stack[ret->memo_base];
+                memo_store(fn, &eval_stack[ret->memo_base + 1], fn->value.compound.children[1]->value.compound.child_count, ret->memo_hash, result);
+                eval_sp = ret->memo_base;
+            }
+            code = ret->code;
+            ip = ret->ip;
+            frame = ret->frame;
+            owned = ret->owned;
+            active_frame = frame;
+            frame_pop_to(frame_end(frame));
+        }
+        PUSH(result);
+        DISPATCH();
+
+    CASE(halt):
+        result = eval_stack[--eval_sp];
+        goto finish;
+
+#ifndef VM_COMPUTED_GOTO
+    }
+#endif
+
+unwind:
+    vm_rp = entry_rp;
+finish:
+    eval_sp = entry_sp;
+    frame_pop_to(frame_end(entry_frame));
+    if (profiling) profile_unwind(entry_frame);
+    return result;
+#undef DISPATCH
+#undef CASE
+#undef PUSH
+}
+
+Node *vm_eval(Node *expr, Env *env) {
+    Frame *saved = active_frame;
+    Node *result = vm_run(compile_toplevel(expr, 1), env, NULL, NULL);
+    active_frame = saved;
+    return result;
+}
+
+/* --- Parallel Primitives --- */
+
+// pmap, pfilter and preduce split a list into chunks shared out to a pool of
+// worker threads by work stealing: each worker takes chunks from the front
+// of its own range and, once that is empty, steals from the back of another
+// worker's. Workers allocate from private arenas with the collector off and
+// treat the globals as read-only. The calling thread works too, then copies
+// the results to the heap.
+#define WORKER_STACK_SIZE (64 * 1024 * 1024)
+#define CHUNKS_PER_WORKER 8
+
+typedef enum { PAR_MAP, PAR_FILTER, PAR_REDUCE } ParallelKind;
+
+typedef struct ParallelJob {
+    Interp *interp; // The instance the job runs in
+    ParallelKind kind;
+    Node *fn;
+    Node **items;
+    int count;
+    int chunk_count;
+    Node **results; // One per item, or one per chunk for PAR_REDUCE
+} ParallelJob;
+
+typedef struct Worker {
+    pthread_t thread;
+    int id;
+    Arena arena;
+    pthread_mutex_t lock; // Guards the chunk range [next, end)
+    int next;
+    int end;
+} Worker;
+
+static int thread_count = 0; // 0 until set by --threads or the first parallel call
+static Worker *workers = NULL; // workers[0] is the calling thread
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+// Held while a job runs, so jobs from different interpreters take turns
+static pthread_mutex_t pool_owner = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static ParallelJob *pool_job = NULL;
+static long pool_generation = 0;
+static int pool_busy = 0;
+
+// Allocates this thread's evaluation stacks
+void init_thread_state() {
+    eval_stack = malloc(EVAL_STACK_MAX * sizeof(Node *));
+    vm_returns = malloc(VM_RETURN_MAX * sizeof(VmReturn));
+    stats_register();
+}
+
+// Frees this thread's evaluation stacks and frames; a host thread that ran
+// an interpreter calls it before exiting
+void free_thread_state() {
+    frame_reset();
+    free(frame_chunk);
+    frame_chunk = NULL;
+    free(eval_stack);
+    eval_stack = NULL;
+    free(vm_returns);
+    vm_returns = NULL;
+    stack_base = NULL;
+    stats_unregister();
+    out_end();
+    free(out_record.data);
+    out_record = (OutBuf){0};
+}
+
+// Calls a top-level function or a primitive from C
+Node *apply_function(Node *fn, Node **args, int arg_count) {
+    if (fn->type == PRIMITIVE_OP) return call_primitive(fn, args, arg_count);
+    Frame *saved = active_frame;
+    Node *error = NULL;
+    Frame *callee = enter_function(fn, args, arg_count, saved, NULL, &error);
+    if (!callee) return error;
+    Node *def = function_def(fn);
+    if (profiling) profile_enter(def->value.compound.children[0]->value.name, callee);
+    active_frame = callee;
+    Node *result = interp->use_tree_walker ? eval(def->value.compound.children[2], &interp->global_env, callee)
+                                   : vm_run(compile_function(def), &interp->global_env, callee, callee);
+    if (profiling) profile_exit();
+    active_frame = saved;
+    frame_pop_to(frame_end(saved));
+    return result;
+}
+
+static void run_chunk(ParallelJob *job, int chunk) {
+    int lo = (int)((long)job->count * chunk / job->chunk_count);
+    int hi = (int)((long)job->count * (chunk + 1) / job->chunk_count);
+    if (job->kind == PAR_REDUCE) {
+        Node *acc = job->items[lo];
+        for (int i = lo + 1; i < hi && acc->type != ERROR; i++) {
+            Node *pair[2] = { acc, job->items[i] };
+            acc = apply_function(job->fn, pair, 2);
+        }
+        job->results[chunk] = acc;
+        return;
+    }
+    for (int i = lo; i < hi; i++) {
+        job->results[i] = apply_function(job->fn, &job->items[i], 1);
+        if (job->results[i]->type == ERROR) break;
+    }
+}
+
+// Takes the next chunk from the worker's own range, else steals one
+static int take_chunk(Worker *self) {
+    for (int k = 0; k < thread_count; k++) {
+        Worker *victim = &workers[(self->id + k) % thread_count];
+        int chunk = -1;
+        pthread_mutex_lock(&victim->lock);
+        if (victim->next < victim->end) chunk = victim == self ? victim->next++ : --victim->end;
+        pthread_mutex_unlock(&victim->lock);
+        if (chunk >= 0) return chunk;
+    }
+    return -1;
+}
+
+static void work(ParallelJob *job, Worker *self) {
+    arena_reset(&self->arena); // The previous job's results have been copied out
+    interp = job->interp;
+    int chunk;
+    while ((chunk = take_chunk(self)) >= 0) run_chunk(job, chunk);
+}
+
+static void *worker_main(void *arg) {
+    Worker *self = arg;
+    char stack_top;
+    set_stack_limit(&stack_top, WORKER_STACK_SIZE);
+    init_thread_state();
+    in_worker = 1;
+    alloc_arena = &self->arena;
+    long seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool_lock);
+        while (pool_generation == seen) pthread_cond_wait(&pool_wake, &pool_lock);
+        seen = pool_generation;
+        ParallelJob *job = pool_job;
+        pthread_mutex_unlock(&pool_lock);
+
+        work(job, self);
+
+        pthread_mutex_lock(&pool_lock);
+        if (--pool_busy == 0) pthread_cond_signal(&pool_done);
+        pthread_mutex_unlock(&pool_lock);
+    }
+    return NULL;
+}
+
+static void start_pool() {
+    if (!thread_count) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cores > 0 ? (int)cores : 1;
+    }
+    workers = calloc(thread_count, sizeof(Worker));
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+    for (int i = 0; i < thread_count; i++) {
+        workers[i].id = i;
+        pthread_mutex_init(&workers[i].lock, NULL);
+        if (i > 0 && pthread_create(&workers[i].thread, &attr, worker_main, &workers[i]) != 0) {
+            thread_count = i; // Run with the threads we have
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+}
+
+// Runs job to completion. Inside a worker (a nested pmap) it runs serially
+// on the current thread.
+static void run_parallel(ParallelJob *job) {
+    if (in_worker) {
+        job->chunk_count = 1;
+        run_chunk(job, 0);
+        return;
+    }
+    pthread_mutex_lock(&pool_owner);
+    if (!workers) start_pool();
+    job->chunk_count = thread_count * CHUNKS_PER_WORKER < job->count ? thread_count * CHUNKS_PER_WORKER : job->count;
+    for (int i = 0; i < thread_count; i++) {
+        workers[i].next = job->chunk_count * i / thread_count;
+        workers[i].end = job->chunk_count * (i + 1) / thread_count;
+    }
+
+    // The calling thread works as workers[0], with the collector off
+    Arena *saved_arena = alloc_arena;
+    int saved_profiling = profiling;
+    in_worker = 1;
+    alloc_arena = &workers[0].arena;
+    profiling = 0;
+
+    if (thread_count > 1) {
+        pthread_mutex_lock(&pool_lock);
+        pool_job = job;
+        pool_busy = thread_count - 1;
+        pool_generation++;
+        pthread_cond_broadcast(&pool_wake);
+        pthread_mutex_unlock(&pool_lock);
+    }
+    work(job, &workers[0]);
+    if (thread_count > 1) {
+        pthread_mutex_lock(&pool_lock);
+        while (pool_busy) pthread_cond_wait(&pool_done, &pool_lock);
+        pthread_mutex_unlock(&pool_lock);
+    }
+
+    in_worker = 0;
+    alloc_arena = saved_arena;
+    profiling = saved_profiling;
+    pthread_mutex_unlock(&pool_owner);
+}
+
+// Worker results live in worker arenas until copied out on the calling thread
+static Node *gather(Node *node) {
+    return in_worker ? node : persist(node);
+}
+
+// Checks the function and list arguments and sets up a job over the list
+static Node *prepare_job(ParallelJob *job, ParallelKind kind, Node *fn, Node *list, int arity, const char *name) {
+    char message[128];
+    if (!is_function(fn)) return make_error_detail(ERR_PARALLEL_FUNCTION, (char *)name);
+    if (fn->type != PRIMITIVE_OP && function_def(fn)->value.compound.children[1]->value.compound.child_count != arity) {
+        snprintf(message, sizeof(message), "Arity mismatch: '%s' function must take %d argument%s", name, arity, arity == 1 ? "" : "s");
+        return make_error(message);
+    }
+    if (list->type != LIST && list->type != DATA) {
+        return make_error_detail(ERR_PARALLEL_LIST, (char *)name);
+    }
+    job->interp = interp;
+    job->kind = kind;
+    job->fn = fn;
+    job->items = list->value.compound.children;
+    job->count = list->value.compound.child_count;
+    job->results = calloc(job->count ? job->count : 1, sizeof(Node *));
+    // Compiled up front, so workers rarely need the compile lock
+    if (fn->type != PRIMITIVE_OP && !interp->use_tree_walker) compile_function(function_def(fn));
+    return NULL;
+}
+
+Node *prim_pmap(Node **args, int arg_count) {
+    if (arg_count != 2) return error_node(ERR_PMAP_ARITY);
+    ParallelJob job;
+    Node *error = prepare_job(&job, PAR_MAP, args[0], args[1], 1, "pmap");
+    if (error) return error;
+    if (job.count) run_parallel(&job);
+    Node *result = make_compound_node(LIST, job.count);
+    for (int i = 0; i < job.count; i++) {
+        if (job.results[i]->type == ERROR) {
+            result = gather(job.results[i]);
+            break;
+        }
+        result->value.compound.children[i] = gather(job.results[i]);
+    }
+    free(job.results);
+    return result;
+}
+
+Node *prim_pfilter(Node **args, int arg_count) {
+    if (arg_count != 2) return error_node(ERR_PFILTER_ARITY);
+    ParallelJob job;
+    Node *error = prepare_job(&job, PAR_FILTER, args[0], args[1], 1, "pfilter");
+    if (error) return error;
+    if (job.count) run_parallel(&job);
+    int kept = 0;
+    for (int i = 0; i < job.count && !error; i++) {
+        if (job.results[i]->type == ERROR) error = gather(job.results[i]);
+        else if (job.results[i]->type != BOOLEAN) error = error_node(ERR_PFILTER_RESULT);
+        else if (job.results[i]->value.number) kept++;
+    }
+    Node *result = error;
+    if (!error) {
+        result = make_compound_node(LIST, kept);
+        kept = 0;
+        for (int i = 0; i < job.count; i++) {
+            if (job.results[i]->value.number) result->value.compound.children[kept++] = job.items[i];
+        }
+    }
+    free(job.results);
+    return result;
+}
+
+Node *prim_preduce(Node **args, int arg_count) {
+    if (arg_count != 3) return error_node(ERR_PREDUCE_ARITY);
+    ParallelJob job;
+    Node *error = prepare_job(&job, PAR_REDUCE, args[0], args[2], 2, "preduce");
+    if (error) return error;
+    Node *acc = args[1];
+    if (job.count) {
+        run_parallel(&job);
+        // Chunk results are folded in order, rooted on the eval stack as calls may collect
+        if (eval_sp + job.chunk_count + 1 > EVAL_STACK_MAX) {
+            free(job.results);
+            return error_node(ERR_STACK_OVERFLOW);
+        }
+        int base = eval_sp;
+        for (int c = 0; c < job.chunk_count; c++) eval_stack[eval_sp++] = gather(job.results[c]);
+        for (int c = 0; c < job.chunk_count && acc->type != ERROR; c++) {
+            if (eval_stack[base + c]->type == ERROR) {
+                acc = eval_stack[base + c];
+                break;
+            }
+            eval_stack[eval_sp] = acc;
+            Node *pair[2] = { acc, eval_stack[base + c] };
+            eval_sp++;
+            acc = apply_function(job.fn, pair, 2);
+            eval_sp--;
+        }
+        eval_sp = base;
+    }
+    free(job.results);
+    return acc;
+}
+
+// Prints the children of a compound node after `open`, then a closing paren
+static void print_children(const char *open, Node *node) {
+    out_cstr(open);
+    for (int i = 0; i < node->value.compound.child_count; i++) {
+        if (i) out_char(' ');
+        print_node(node->value.compound.children[i]);
+    }
+    out_char(')');
+}
+
+// Serializes node into the thread's output record
+void print_node(Node *node) {
+    if (!node) {
+        out_cstr("nil");
+        return;
+    }
+    switch(node->type) {
+        case NUMBER:
+            out_long(node->value.number);
+            break;
+        case BOOLEAN:
+            out_cstr(node->value.number == 1 ? "true" : "false");
+            break;
+        case SYMBOL:
+            out_cstr(node->value.name);
+            break;
+        case PRIMITIVE_OP:
+            out_cstr(node->value.prim.name);
+            break;
+        case LOCAL_REF:
+            out_cstr(node->value.ref.name);
+            break;
+        case STRING:
+            out_char('"');
+            out_write(string_chars(node), node->value.str.length);
+            out_char('"');
+            break;
+        case VECTOR:
+            out_cstr("vector(");
+            for (int i = 0; i < node->value.vector.length; i++) {
+                if (i) out_char(' ');
+                out_long(node->value.vector.items[i]);
+            }
+            out_char(')');
+            break;
+        case SEQ:
+            // The pipeline, since printing the elements would compute them
+            if (node->value.seq.kind == SEQ_RANGE) {
+                out_cstr("range(");
+                out_long(node->value.seq.next);
+                out_char(' ');
+                out_long(node->value.seq.end);
+                if (node->value.seq.step != 1) {
+                    out_char(' ');
+                    out_long(node->value.seq.step);
+                }
+            } else if (node->value.seq.kind == SEQ_TAKE) {
+                out_cstr("take(");
+                out_long(node->value.seq.count);
+                out_char(' ');
+                print_node(node->value.seq.source);
+            } else {
+                out_cstr(node->value.seq.kind == SEQ_MAP ? "map(" : "filter(");
+                print_node(node->value.seq.fn);
+                out_char(' ');
+                print_node(node->value.seq.source);
+            }
+            out_char(')');
+            break;
+        case ERROR:
+            out_cstr("Error: ");
+            out_cstr(error_message(node));
+            break;
+        case LIST:
+            print_children("list(", node);
+            break;
+        case FUNCTION_CALL:
+            print_children("func_call(", node);
+            break;
+        case DATA:
+            print_children("data(", node);
+            break;
+        case DEF:
+        case CLOSURE:
+            // A function prints as its name
+            print_node(function_def(node)->value.compound.children[0]);
+            break;
+        default:
+            out_char('?');
+    }
+}
+
+/* --- Interpreter Instances --- */
+
+// Binds `in` as the current thread's instance, returning the previous one
+static inline Interp *interp_bind(Interp *in) {
+    Interp *saved = interp;
+    interp = in;
+    return saved;
+}
+
+// Creates an interpreter with the primitives bound in its global environment
+Interp *interp_new() {
+    static pthread_once_t constants_once = PTHREAD_ONCE_INIT;
+    pthread_once(&constants_once, init_constants);
+
+    Interp *in = calloc(1, sizeof(Interp));
+    in->gc_threshold = GC_MIN_THRESHOLD;
+    in->memo_limit = MEMO_DEFAULT_LIMIT;
+    in->global_env.epoch = 1; // Empty caches hold epoch 0
+    Interp *saved = interp_bind(in);
+    for (int op = 0; op < OP_COUNT; op++) {
+        define(&in->global_env, primitives[op].name, make_primitive_op(op));
+    }
+    define_constant(&in->global_env, "true", make_boolean(1));
+    define_constant(&in->global_env, "false", make_boolean(0));
+    interp = saved;
+    return in;
+}
+
+void free_profile_tree(ProfileNode *node) {
+    ProfileNode *child = node->child;
+    while (child) {
+        ProfileNode *next = child->sibling;
+        free_profile_tree(child);
+        free(child);
+        child = next;
+    }
+}
+
+// Frees what an image node owns outside its ImageBlock
+static void image_block_free_node(Node *node) {
+    if (node->type == DEF) free(node->value.compound.code);
+    else if (node->type == VECTOR) free(node->value.vector.items);
+}
+
+// Releases everything the interpreter owns. No thread may be running it.
+void interp_free(Interp *in) {
+    Interp *saved = interp_bind(in);
+    memo_clear();
+    while (in->scripts) {
+        Script *next = in->scripts->next;
+        for (int i = 0; i < in->scripts->count; i++) free(in->scripts->code[i]);
+        free(in->scripts->code);
+        free(in->scripts->forms);
+        free(in->scripts);
+        in->scripts = next;
+    }
+    while (in->images) {
+        ImageBlock *next = in->images->next;
+        for (uint32_t i = 0; i < in->images->node_count; i++) {
+            image_block_free_node(&in->images->nodes[i]);
+        }
+        free(in->images->nodes);
+        free(in->images->children);
+        free(in->images->strings);
+        free(in->images);
+        in->images = next;
+    }
+    for (HeapPage *page = in->heap_pages; page;) {
+        HeapPage *next = page->next;
+        for (int i = 0; i < HEAP_PAGE_NODES; i++) {
+            if (!(page->nodes[i].flags & NODE_FREE)) gc_finalize(&page->nodes[i]);
+        }
+        free(page);
+        page = next;
+    }
+    arena_reset(&in->ast_arena);
+    free(in->ast_arena.head);
+    for (int i = 0; i < in->symbol_buckets; i++) {
+        Symbol *sym = in->symbol_table[i];
+        while (sym) {
+            Symbol *next = sym->next;
+            free(sym);
+            sym = next;
+        }
+    }
+    for (int i = 0; i < PROFILE_BUCKETS; i++) {
+        ProfileEntry *entry = in->profile_table[i];
+        while (entry) {
+            ProfileEntry *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+    }
+    free_profile_tree(&in->profile_root);
+    free(in->profile_stack);
+    free(in->symbol_table);
+    free(in->memo_table);
+    free(in->mark_stack);
+    free(in->global_env.slots);
+    free(in->input_buffer);
+    free(in);
+    interp = saved;
+}
+
+// Sets up the calling thread's evaluation state on its first use
+static void ensure_thread_state() {
+    if (!eval_stack) init_thread_state();
+    if (!stack_base) {
+        char here;
+        init_stack_limit(&here);
+    }
+}
+
+/* --- Embedding API --- */
+
+// The listscript.h entry points. Each binds its interpreter for the call.
+
+static Script *script_new(Interp *in) {
+    Script *script = calloc(1, sizeof(Script));
+    script->interp = in;
+    script->next = in->scripts;
+    in->scripts = script;
+    return script;
+}
+
+static void script_add(Script *script, Node *form) {
+    // Capacity is implied by the count: 16, then each power of two
+    int count = script->count;
+    if (count == 0 || (count >= 16 && (count & (count - 1)) == 0)) {
+        script->forms = realloc(script->forms, (count ? count * 2 : 16) * sizeof(Node *));
+    }
+    script->forms[script->count++] = form;
+}
+
+static void script_finish(Script *script) {
+    script->code = calloc(script->count ? script->count : 1, sizeof(Code *));
+}
+
+// Unlinks a script that failed to load; its forms become garbage
+static void script_discard(Script *script) {
+    Script **link = &script->interp->scripts;
+    while (*link != script) link = &(*link)->next;
+    *link = script->next;
+    for (int i = 0; i < script->count && script->code; i++) free(script->code[i]);
+    free(script->code);
+    free(script->forms);
+    free(script);
+}
+
+// Runs one top-level form of a script on the bound interpreter
+static Node *script_run_form(Script *script, int i) {
+    Env *env = &script->interp->global_env;
+    frame_reset();
+    gc_safe_point();
+    if (script->interp->use_tree_walker) return eval(script->forms[i], env, NULL);
+    if (!script->code[i]) script->code[i] = compile_toplevel(script->forms[i], 0);
+    Node *result = vm_run(script->code[i], env, NULL, NULL);
+    active_frame = NULL;
+    return result;
+}
+
+ls_interp *ls_new(void) {
+    return interp_new();
+}
+
+void ls_free(ls_interp *ls) {
+    interp_free(ls);
+}
+
+int ls_register(ls_interp *ls, const char *name, ls_primitive fn) {
+    Interp *saved = interp_bind(ls);
+    int ok = define(&ls->global_env, (char *)name, make_host_primitive((char *)name, fn));
+    interp = saved;
+    return ok;
+}
+
+int ls_define(ls_interp *ls, const char *name, ls_value *value) {
+    Interp *saved = interp_bind(ls);
+    int ok = define(&ls->global_env, (char *)name, persist(value));
+    interp = saved;
+    return ok;
+}
+
+ls_script *ls_compile(ls_interp *ls, const char *source) {
+    Interp *saved = interp_bind(ls);
+    // The tokenizer only reads the buffer, so it can scan the source in place
+    // while the interpreter's own input is set aside
+    char *saved_input = ls->input_buffer;
+    size_t saved_pos = ls->input_pos;
+    ls->input_buffer = (char *)source;
+    ls->input_pos = 0;
+
+    Script *script = script_new(ls);
+    // Parsed straight onto the heap, since the forms outlive this call
+    Arena *saved_arena = alloc_arena;
+    alloc_arena = NULL;
+    while (gettoken() && !token_is("bye")) {
+        // REPL commands only mean something to run_script
+        if (interp->token[0] == ':') {
+            if (command_takes_path()) gettoken();
+            continue;
+        }
+        Node *form = parse_expression();
+        if (!form) {
+            script_discard(script);
+            script = NULL;
+            break;
+        }
+        resolve(form, NULL);
+        script_add(script, fold(form, &ls->global_env));
+    }
+    if (script) script_finish(script);
+    alloc_arena = saved_arena;
+    ls->input_buffer = saved_input;
+    ls->input_pos = saved_pos;
+    interp = saved;
+    return script;
+}
+
+ls_value *ls_run(ls_script *script) {
+    Interp *saved = interp_bind(script->interp);
+    ensure_thread_state();
+    Node *result = NULL;
+    // Top-level forms run with no frames below them
+    if (eval_sp || active_frame) {
+        result = error_node(ERR_NESTED_RUN);
+        interp = saved;
+        return result;
+    }
+    for (int i = 0; i < script->count; i++) {
+        result = script_run_form(script, i);
+        if (result->type == ERROR) break;
+    }
+    out_flush(); // What the script wrote comes before anything the host prints next
+    interp = saved;
+    return result;
+}
+
+ls_value *ls_call(ls_script *script, const char *name, ls_value **args, int arg_count) {
+    Interp *saved = interp_bind(script->interp);
+    ensure_thread_state();
+    // Hosts usually pass the same string each time, so its interned form is kept
+    if (name != script->call_name) {
+        script->call_name = name;
+        script->call_symbol = intern(name);
+    }
+    Node *fn = lookup(&script->interp->global_env, script->call_symbol);
+    Node *result;
+    if (!fn || !is_function(fn)) {
+        result = make_error_detail(ERR_UNDEFINED_FUNCTION, script->call_symbol);
+    } else if (eval_sp + arg_count > EVAL_STACK_MAX) {
+        result = error_node(ERR_STACK_OVERFLOW);
+    } else {
+        // The arguments are rooted on the eval stack across the safe point
+        int base = eval_sp;
+        for (int i = 0; i < arg_count; i++) eval_stack[eval_sp++] = args[i];
+        gc_safe_point();
+        result = apply_function(fn, &eval_stack[base], arg_count);
+        eval_sp = base;
+    }
+    out_flush();
+    interp = saved;
+    return result;
+}
+
+ls_value *ls_number(ls_interp *ls, long number) {
+    Interp *saved = interp_bind(ls);
+    Node *node = make_number(number);
+    interp = saved;
+    return node;
+}
+
+ls_value *ls_boolean(ls_interp *ls, int value) {
+    (void)ls;
+    return make_boolean(value);
+}
+
+ls_value *ls_string(ls_interp *ls, const char *string) {
+    Interp *saved = interp_bind(ls);
+    Node *node = make_string((char *)string);
+    interp = saved;
+    return node;
+}
+
+ls_value *ls_list(ls_interp *ls, ls_value **items, int count) {
+    Interp *saved = interp_bind(ls);
+    Node *node = make_compound_node(LIST, count);
+    if (count) memcpy(node->value.compound.children, items, count * sizeof(Node *));
+    interp = saved;
+    return node;
+}
+
+ls_value *ls_error(ls_interp *ls, const char *message) {
+    Interp *saved = interp_bind(ls);
+    Node *node = make_error((char *)message);
+    interp = saved;
+    return node;
+}
+
+ls_type ls_typeof(ls_value *value) {
+    switch (value->type) {
+        case NUMBER: return LS_NUMBER;
+        case BOOLEAN: return LS_BOOLEAN;
+        case STRING: return LS_STRING;
+        case LIST:
+        case DATA: return LS_LIST;
+        case ERROR: return LS_ERROR;
+        case DEF:
+        case CLOSURE:
+        case PRIMITIVE_OP: return LS_FUNCTION;
+        default: return LS_OTHER;
+    }
+}
+
+long ls_to_number(ls_value *value) {
+    return value->type == NUMBER || value->type == BOOLEAN ? value->value.number : 0;
+}
+
+const char *ls_to_string(ls_value *value) {
+    if (value->type == STRING) return string_cstr(value);
+    if (value->type == ERROR) return error_message(value);
+    return NULL;
+}
+
+int ls_length(ls_value *value) {
+    return value->type == LIST || value->type == DATA ? value->value.compound.child_count : 0;
+}
+
+ls_value *ls_item(ls_value *value, int index) {
+    if (index < 0 || index >= ls_length(value)) return NULL;
+    return value->value.compound.children[index];
+}
+
+void ls_print(ls_value *value) {
+    print_node(value);
+    out_flush();
+}
+
+void ls_thread_exit(void) {
+    free_thread_state();
+}
+
+/* --- Images --- */
+
+// An image is a saved node graph: a compiled script's resolved forms, or
+// (for :save, as a snapshot) the global bindings. Nodes are records in a flat
+// array of words and refer to each other by index, so an image loads at any
+// address. Names and strings follow the records, shared where the pointers were.
+//
+//     header | roots | records | strings
+//
+// Index 0 is NULL and node i is index i + 1. Each record starts with
+// type | flags << 8 | fold_deps << 16, followed by:
+//     NUMBER, BOOLEAN                   low word, high word
+//     SYMBOL, STRING, ERROR             string offset
+//     PRIMITIVE_OP                      name offset, rebound on load
+//     LOCAL_REF                         name offset, slot, captured
+//     LIST_BUFFER                       count, items
+//     VECTOR                            length, then each item's low and high words
+//     SEQ                               kind, then a range's next, end and step as low
+//                                       and high words, or source, head, and function
+//                                       or a take's count as low and high words
+//     CLOSURE                           function, count, then the captured values
+//     LIST, ARGS, DEF, DATA, IF, CALL   child count, frame size (a call's folded value),
+//                                       captures or owner, then the children, or a slice's start
+#define IMAGE_MAGIC "LSI"
+#define SNAPSHOT_MAGIC "LSS" // Roots pair a SYMBOL naming each global, NODE_CONST for a defconst, with its value
+#define IMAGE_VERSION 2
+#define IMAGE_BYTE_ORDER 0x01020304 // Images are read on machines like their writer's
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t node_count;
+    uint32_t root_count;
+    uint32_t word_count;
+    uint32_t string_bytes;
+} ImageHeader;
+
+// Pointer to index, for nodes and for strings
+typedef struct {
+    const void **keys;
+    uint32_t *values;
+    size_t capacity;
+    size_t count;
+} ImageMap;
+
+typedef struct {
+    ImageMap nodes;
+    Node **order; // Nodes by index, appended as they are first referenced
+    uint32_t *words;
+    size_t word_count, word_capacity;
+    ImageMap strings;
+    char *string_data;
+    size_t string_bytes, string_capacity;
+} ImageWriter;
+
+static uint32_t *image_map_slot(ImageMap *map, const void *key, int *found) {
+    if (map->count * 2 >= map->capacity) {
+        ImageMap old = *map;
+        map->capacity = old.capacity ? old.capacity * 2 : 256;
+        map->keys = calloc(map->capacity, sizeof(void *));
+        map->values = malloc(map->capacity * sizeof(uint32_t));
+        map->count = 0;
+        for (size_t i = 0; i < old.capacity; i++) {
+            if (!old.keys[i]) continue;
+            int dup;
+            *image_map_slot(map, old.keys[i], &dup) = old.values[i];
+        }
+        free(old.keys);
+        free(old.values);
+    }
+    size_t mask = map->capacity - 1;
+    size_t i = ((uintptr_t)key >> 3) * 0x9E3779B97F4A7C15ull >> 20 & mask;
+    while (map->keys[i] && map->keys[i] != key) i = (i + 1) & mask;
+    *found = map->keys[i] != NULL;
+    if (!*found) {
+        map->keys[i] = key;
+        map->count++;
+    }
+    return &map->values[i];
+}
+
+static void image_word(ImageWriter *w, uint32_t word) {
+    if (w->word_count == w->word_capacity) {
+        w->word_capacity = w->word_capacity ? w->word_capacity * 2 : 1024;
+        w->words = realloc(w->words, w->word_capacity * sizeof(uint32_t));
+    }
+    w->words[w->word_count++] = word;
+}
+
+static uint32_t image_ref(ImageWriter *w, Node *node) {
+    if (!node) return 0;
+    int found;
+    uint32_t *index = image_map_slot(&w->nodes, node, &found);
+    if (!found) {
+        *index = w->nodes.count;
+        w->order = realloc(w->order, w->nodes.count * sizeof(Node *));
+        w->order[*index - 1] = node;
+    }
+    return *index;
+}
+
+// Appends `length` chars and a NUL to the strings, returning their offset
+static uint32_t image_bytes(ImageWriter *w, const char *chars, size_t length) {
+    while (w->string_bytes + length + 1 > w->string_capacity) {
+        w->string_capacity = w->string_capacity ? w->string_capacity * 2 : 4096;
+        w->string_data = realloc(w->string_data, w->string_capacity);
+    }
+    memcpy(w->string_data + w->string_bytes, chars, length);
+    w->string_data[w->string_bytes + length] = '\0';
+    uint32_t offset = w->string_bytes;
+    w->string_bytes += length + 1;
+    return offset;
+}
+
+// Names are shared by pointer; STRING values (possibly views) are written whole
+static uint32_t image_string(ImageWriter *w, const char *string) {
+    int found;
+    uint32_t *offset = image_map_slot(&w->strings, string, &found);
+    if (!found) *offset = image_bytes(w, string, strlen(string));
+    return *offset;
+}
+
+static void image_record(ImageWriter *w, Node *node) {
+    int call = node->type == LIST || node->type == FUNCTION_CALL;
+    uint32_t deps = call && node->value.compound.folded ? node->value.compound.fold_deps : 0;
+    image_word(w, node->type | (node->flags & (NODE_MEMO | NODE_CONST | NODE_LATE)) << 8 | deps << 16);
+    switch (node->type) {
+        case NUMBER:
+        case BOOLEAN:
+            image_word(w, (uint32_t)(unsigned long)node->value.number);
+            image_word(w, (uint32_t)((unsigned long)node->value.number >> 32));
+            break;
+        case SYMBOL:
+            image_word(w, image_string(w, node->value.name));
+            break;
+        case ERROR:
+            image_word(w, image_string(w, error_message(node)));
+            break;
+        case STRING:
+            image_word(w, image_bytes(w, string_chars(node), node->value.str.length));
+            break;
+        case PRIMITIVE_OP:
+            image_word(w, image_string(w, node->value.prim.name));
+            break;
+        case LOCAL_REF:
+            image_word(w, image_string(w, node->value.ref.name));
+            image_word(w, node->value.ref.slot);
+            image_word(w, node->value.ref.captured);
+            break;
+        case CLOSURE:
+            image_word(w, image_ref(w, node->value.closure.def));
+            image_word(w, node->value.closure.count);
+            for (int i = 0; i < node->value.closure.count; i++) {
+                image_word(w, image_ref(w, node->value.closure.values[i]));
+            }
+            break;
+        case VECTOR:
+            // Views are saved whole
+            image_word(w, node->value.vector.length);
+            for (int i = 0; i < node->value.vector.length; i++) {
+                image_word(w, (uint32_t)(unsigned long)node->value.vector.items[i]);
+                image_word(w, (uint32_t)((unsigned long)node->value.vector.items[i] >> 32));
+            }
+            break;
+        case SEQ:
+            image_word(w, node->value.seq.kind);
+            if (node->value.seq.kind == SEQ_RANGE) {
+                long numbers[3] = { node->value.seq.next, node->value.seq.end, node->value.seq.step };
+                for (int i = 0; i < 3; i++) {
+                    image_word(w, (uint32_t)(unsigned long)numbers[i]);
+                    image_word(w, (uint32_t)((unsigned long)numbers[i] >> 32));
+                }
+                break;
+            }
+            image_word(w, image_ref(w, node->value.seq.source));
+            image_word(w, image_ref(w, node->value.seq.head));
+            if (node->value.seq.kind == SEQ_TAKE) {
+                image_word(w, (uint32_t)(unsigned long)node->value.seq.count);
+                image_word(w, (uint32_t)((unsigned long)node->value.seq.count >> 32));
+            } else {
+                image_word(w, image_ref(w, node->value.seq.fn));
+                image_word(w, 0);
+            }
+            image_word(w, 0);
+            image_word(w, 0);
+            break;
+        case LIST_BUFFER: {
+            // Only the filled items are kept; the loaded buffer copies on its next cons
+            int start = node->value.buffer.start;
+            image_word(w, node->value.buffer.capacity - start);
+            for (int i = start; i < node->value.buffer.capacity; i++) {
+                image_word(w, image_ref(w, node->value.buffer.items[i]));
+            }
+            break;
+        }
+        default: {
+            Node *link = node->value.compound.captures; // Or, for a LIST, its owner
+            image_word(w, node->value.compound.child_count);
+            image_word(w, call ? image_ref(w, node->value.compound.folded) : (uint32_t)node->value.compound.frame_size);
+            image_word(w, node->type == DEF || node->type == LIST ? image_ref(w, link) : 0);
+            if (node->type == LIST && link) {
+                Node **base = link->type == LIST_BUFFER ? link->value.buffer.items + link->value.buffer.start
+                                                        : link->value.compound.children;
+                image_word(w, node->value.compound.children - base);
+                break;
+            }
+            for (int i = 0; i < node->value.compound.child_count; i++) {
+                image_word(w, image_ref(w, node->value.compound.children[i]));
+            }
+            break;
+        }
+    }
+}
+
+// Writes the graph reachable from `roots` to `path`, under `magic`. Returns 0
+// on failure.
+int image_save(Node **roots, int root_count, const char *magic, const char *path) {
+    ImageWriter w = {0};
+    uint32_t *root_refs = malloc((root_count ? root_count : 1) * sizeof(uint32_t));
+    for (int i = 0; i < root_count; i++) root_refs[i] = image_ref(&w, roots[i]);
+    // Records are written in index order; each only appends later nodes
+    for (size_t i = 0; i < w.nodes.count; i++) image_record(&w, w.order[i]);
+
+    ImageHeader header = { "", IMAGE_VERSION, IMAGE_BYTE_ORDER, w.nodes.count, root_count,
+                           w.word_count, w.string_bytes };
+    memcpy(header.magic, magic, sizeof(header.magic));
+    FILE *file = fopen(path, "wb");
+    int ok = file &&
+             fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(root_refs, sizeof(uint32_t), root_count, file) == (size_t)root_count &&
+             fwrite(w.words, sizeof(uint32_t), w.word_count, file) == w.word_count &&
+             fwrite(w.string_data, 1, w.string_bytes, file) == w.string_bytes;
+    if (file && fclose(file) != 0) ok = 0;
+    free(root_refs);
+    free(w.nodes.keys);
+    free(w.nodes.values);
+    free(w.order);
+    free(w.words);
+    free(w.strings.keys);
+    free(w.strings.values);
+    free(w.string_data);
+    return ok;
+}
+
+typedef struct {
+    const uint32_t *words;
+    uint32_t word_count;
+    uint32_t string_bytes;
+    uint32_t node_count;
+    Node **nodes;
+    uint32_t *offsets; // Of each node's record
+    ImageBlock *block;
+} ImageReader;
+
+static char *image_read_string(ImageReader *r, uint32_t offset) {
+    return offset < r->string_bytes ? r->block->strings + offset : NULL;
+}
+
+static Node *image_new_node(ImageReader *r, uint32_t type) {
+    Node *node = &r->block->nodes[r->block->node_count++];
+    node->type = type;
+    node->flags = NODE_STATIC | NODE_PERSISTENT;
+    return node;
+}
+
+// Pass 1: allocates the node of the record at words[*pos] and moves past it.
+// Returns NULL if the record is malformed.
+static Node *image_alloc(ImageReader *r, uint32_t *pos) {
+    const uint32_t *word = r->words + *pos;
+    uint32_t left = r->word_count - *pos;
+    uint32_t type = word[0] & 0xff;
+    unsigned char flags = (word[0] >> 8) & (NODE_MEMO | NODE_CONST | NODE_LATE);
+    uint32_t deps = word[0] >> 16;
+    Node *node = NULL;
+    char *name;
+    uint32_t size;
+    switch (type) {
+        case NUMBER:
+        case BOOLEAN: {
+            if (left < 3) return NULL;
+            long number = (long)((unsigned long)word[1] | (unsigned long)word[2] << 32);
+            *pos += 3;
+            // Booleans and small integers come back as the shared constants
+            if (type == BOOLEAN) return make_boolean(number);
+            if (number >= SMALL_INT_MIN && number <= SMALL_INT_MAX) return make_number(number);
+            node = image_new_node(r, NUMBER);
+            node->value.number = number;
+            node->flags |= flags;
+            return node;
+        }
+        case SYMBOL:
+        case STRING:
+        case ERROR:
+            if (left < 2 || !(name = image_read_string(r, word[1]))) return NULL;
+            node = image_new_node(r, type);
+            if (type == SYMBOL) node->value.name = intern(name);
+            else if (type == STRING) {
+                node->value.str.chars = name;
+                node->value.str.length = strlen(name);
+            }
+            else node->value.error.message = name;
+            size = 2;
+            break;
+        case PRIMITIVE_OP: {
+            // Bound to the loading interpreter's primitive of that name, copied
+            // since a host primitive's node goes away if it is re-registered.
+            // A script may have rebound a built-in's name, so those come from the table.
+            if (left < 2 || !(name = image_read_string(r, word[1]))) return NULL;
+            Node *prim = lookup(&interp->global_env, intern(name));
+            if (prim && (prim->type != PRIMITIVE_OP || strcmp(prim->value.prim.name, name) != 0)) prim = NULL;
+            int op = 0;
+            while (!prim && op < OP_COUNT && strcmp(primitives[op].name, name) != 0) op++;
+            if (!prim && op == OP_COUNT) return NULL;
+            node = image_new_node(r, PRIMITIVE_OP);
+            if (prim) node->value.prim = prim->value.prim;
+            else {
+                node->value.prim.name = primitives[op].name;
+                node->value.prim.opcode = op;
+                node->value.prim.fn = primitives[op].fn;
+            }
+            size = 2;
+            break;
+        }
+        case LOCAL_REF:
+            // Bounded here; the slot is checked against its function's frame once the DEFs are linked
+            if (left < 4 || !(name = image_read_string(r, word[1]))) return NULL;
+            if (word[2] > r->node_count || word[3] > 1) return NULL;
+            node = image_new_node(r, LOCAL_REF);
+            node->value.ref.name = intern(name);
+            node->value.ref.slot = word[2];
+            node->value.ref.captured = word[3];
+            size = 4;
+            break;
+        case CLOSURE:
+            if (left < 3 || word[2] > left - 3) return NULL;
+            node = image_new_node(r, CLOSURE);
+            node->value.closure.values = r->block->children + r->block->child_count;
+            node->value.closure.count = word[2];
+            r->block->child_count += word[2];
+            size = 3 + word[2];
+            break;
+        case VECTOR:
+            if (left < 2 || word[1] > (left - 2) / 2) return NULL;
+            node = image_new_node(r, VECTOR);
+            node->value.vector.items = malloc((word[1] ? word[1] : 1) * sizeof(long));
+            node->value.vector.length = word[1];
+            for (uint32_t i = 0; i < word[1]; i++) {
+                node->value.vector.items[i] = (long)((unsigned long)word[2 + 2 * i] | (unsigned long)word[3 + 2 * i] << 32);
+            }
+            size = 2 + 2 * word[1];
+            break;
+        case SEQ:
+            if (left < 8 || word[1] > SEQ_TAKE) return NULL;
+            node = image_new_node(r, SEQ);
+            node->value.seq.kind = word[1];
+            if (word[1] == SEQ_RANGE) {
+                node->value.seq.next = (long)((unsigned long)word[2] | (unsigned long)word[3] << 32);
+                node->value.seq.end = (long)((unsigned long)word[4] | (unsigned long)word[5] << 32);
+                node->value.seq.step = (long)((unsigned long)word[6] | (unsigned long)word[7] << 32);
+                if (!node->value.seq.step) return NULL;
+            } else if (word[1] == SEQ_TAKE) {
+                node->value.seq.count = (long)((unsigned long)word[4] | (unsigned long)word[5] << 32);
+            }
+            size = 8;
+            break;
+        case LIST_BUFFER:
+            if (left < 2 || word[1] > left - 2) return NULL;
+            node = image_new_node(r, LIST_BUFFER);
+            node->value.buffer.items = r->block->children + r->block->child_count;
+            node->value.buffer.capacity = word[1];
+            node->value.buffer.start = 0;
+            r->block->child_count += word[1];
+            size = 2 + word[1];
+            break;
+        case DEF:
+        case ARGS:
+        case LIST:
+        case DATA:
+        case IF:
+        case FUNCTION_CALL: {
+            if (left < 4 || word[2] > r->node_count || word[3] > r->node_count) return NULL;
+            int slice = type == LIST && word[3];
+            if ((!slice && word[1] > left - 4) || (slice && left < 5)) return NULL;
+            if (type == DEF && word[1] != 2 && word[1] != 3) return NULL;
+            if (type == IF && word[1] != 3) return NULL;
+            node = image_new_node(r, type);
+            node->value.compound.child_count = word[1];
+            if (type == LIST || type == FUNCTION_CALL) node->value.compound.fold_deps = deps;
+            else node->value.compound.frame_size = word[2];
+            if (!slice) {
+                node->value.compound.children = r->block->children + r->block->child_count;
+                r->block->child_count += word[1];
+            }
+            size = slice ? 5 : 4 + word[1];
+            break;
+        }
+        default:
+            return NULL;
+    }
+    if (deps && type != LIST && type != FUNCTION_CALL) return NULL;
+    node->flags |= flags;
+    *pos += size;
+    return node;
+}
+
+static Node *image_node(ImageReader *r, uint32_t ref, int *ok) {
+    if (ref > r->node_count) *ok = 0;
+    return ref && ref <= r->node_count ? r->nodes[ref - 1] : NULL;
+}
+
+// Pass 2: fills in a node's references from its record
+static int image_link(ImageReader *r, Node *node, const uint32_t *word) {
+    int ok = 1;
+    switch (node->type) {
+        case LIST_BUFFER:
+            for (uint32_t i = 0; i < word[1]; i++) node->value.buffer.items[i] = image_node(r, word[2 + i], &ok);
+            break;
+        case SEQ: {
+            if (node->value.seq.kind == SEQ_RANGE) break;
+            Node *source = image_node(r, word[2], &ok);
+            if (!source || !is_sequence(source)) return 0;
+            node->value.seq.source = source;
+            node->value.seq.head = image_node(r, word[3], &ok);
+            if (node->value.seq.kind != SEQ_TAKE) {
+                Node *fn = image_node(r, word[4], &ok);
+                if (!fn || !is_function(fn)) return 0;
+                node->value.seq.fn = fn;
+            }
+            break;
+        }
+        case CLOSURE: {
+            // Its values fill the last slots of the function's frame
+            Node *def = image_node(r, word[1], &ok);
+            if (!def || def->type != DEF || def->value.compound.child_count != 3 ||
+                node->value.closure.count >= def->value.compound.frame_size) return 0;
+            node->value.closure.def = def;
+            for (uint32_t i = 0; i < word[2]; i++) node->value.closure.values[i] = image_node(r, word[3 + i], &ok);
+            break;
+        }
+        case DEF:
+        case ARGS:
+        case LIST:
+        case DATA:
+        case IF:
+        case FUNCTION_CALL: {
+            Node *link = image_node(r, word[3], &ok);
+            if (node->type == LIST || node->type == FUNCTION_CALL) {
+                Node *folded = image_node(r, word[2], &ok);
+                if (folded && folded->type != NUMBER && folded->type != BOOLEAN) return 0;
+                node->value.compound.folded = folded;
+            }
+            if (node->type == DEF) {
+                if (link && (link->type != ARGS || link->value.compound.child_count >= node->value.compound.frame_size)) return 0;
+                node->value.compound.captures = link;
+            } else if (node->type == LIST && link) {
+                // The owner must hold the slice's children itself
+                uint32_t start = word[4], count = word[1];
+                if (link->type == LIST_BUFFER) {
+                    if (start > (uint32_t)link->value.buffer.capacity || count > link->value.buffer.capacity - start) return 0;
+                    node->value.compound.children = link->value.buffer.items + start;
+                } else if (link->type == LIST && !r->words[r->offsets[word[3] - 1] + 3]) {
+                    if (start > (uint32_t)link->value.compound.child_count || count > link->value.compound.child_count - start) return 0;
+                    node->value.compound.children = link->value.compound.children + start;
+                } else {
+                    return 0;
+                }
+                node->value.compound.owner = link;
+                break;
+            }
+            for (uint32_t i = 0; i < word[1]; i++) {
+                Node *child = image_node(r, word[4 + i], &ok);
+                if (!child) return 0;
+                node->value.compound.children[i] = child;
+            }
+            // A call's frame holds the function itself and its parameters
+            if (node->type == DEF && word[1] == 3) {
+                Node *args = node->value.compound.children[1];
+                if (args->type != ARGS || args->value.compound.child_count >= node->value.compound.frame_size) return 0;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return ok;
+}
+
+// Pass 3: a LOCAL_REF addresses a slot in the frame of the function running
+// the code it is in. Checks the refs under node, which runs in fn's frame
+// (NULL at top level), down to the function DEFs nested in it: their names
+// and captures are read in fn's frame, and their bodies are checked on their
+// own. `seen` marks the nodes visited by this walk.
+static int image_check_refs(ImageReader *r, Node *node, Node *fn, uint32_t *seen, uint32_t walk) {
+    if (!node || node < r->block->nodes || node >= r->block->nodes + r->block->node_count) return 1;
+    uint32_t index = node - r->block->nodes;
+    if (seen[index] == walk) return 1;
+    seen[index] = walk;
+    switch (node->type) {
+        case LOCAL_REF:
+            return fn && node->value.ref.slot < fn->value.compound.frame_size;
+        case LIST_BUFFER:
+            for (int i = 0; i < node->value.buffer.capacity; i++) {
+                if (!image_check_refs(r, node->value.buffer.items[i], fn, seen, walk)) return 0;
+            }
+            return 1;
+        case DEF:
+            if (node->value.compound.child_count == 3) {
+                return image_check_refs(r, node->value.compound.children[0], fn, seen, walk) &&
+                       image_check_refs(r, node->value.compound.captures, fn, seen, walk);
+            }
+            /* fallthrough */
+        case ARGS:
+        case LIST:
+        case DATA:
+        case IF:
+        case FUNCTION_CALL:
+            for (int i = 0; i < node->value.compound.child_count; i++) {
+                if (!image_check_refs(r, node->value.compound.children[i], fn, seen, walk)) return 0;
+            }
+            return 1;
+        default:
+            return 1;
+    }
+}
+
+// Reads an image written by image_save under `magic` into a new ImageBlock of
+// the bound interpreter. Returns its roots, malloc'd, or NULL if the file is
+// not a valid image of that kind.
+Node **image_load(const char *path, const char *magic, int *root_count) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ImageHeader)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    const ImageHeader *header = map;
+    ImageReader r = {0};
+    Node **roots = NULL;
+    size_t size = sizeof(ImageHeader) + ((size_t)header->root_count + header->word_count) * sizeof(uint32_t) +
+                  header->string_bytes;
+    if (memcmp(header->magic, magic, 4) != 0 || header->version != IMAGE_VERSION ||
+        header->byte_order != IMAGE_BYTE_ORDER || size != (size_t)st.st_size || header->node_count > header->word_count ||
+        (header->string_bytes && ((const char *)map)[size - 1] != '\0')) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    const uint32_t *root_refs = (const uint32_t *)(header + 1);
+    r.words = root_refs + header->root_count;
+    r.word_count = header->word_count;
+    r.string_bytes = header->string_bytes;
+    r.node_count = header->node_count;
+    r.nodes = malloc((r.node_count ? r.node_count : 1) * sizeof(Node *));
+    r.offsets = malloc((r.node_count ? r.node_count : 1) * sizeof(uint32_t));
+    // Child arrays take one word per child in their records, so word_count bounds them
+    r.block = calloc(1, sizeof(ImageBlock));
+    r.block->nodes = calloc(r.node_count ? r.node_count : 1, sizeof(Node));
+    r.block->children = malloc((r.word_count ? r.word_count : 1) * sizeof(Node *));
+    r.block->strings = malloc(r.string_bytes ? r.string_bytes : 1);
+    memcpy(r.block->strings, (const char *)(r.words + r.word_count), r.string_bytes);
+
+    uint32_t pos = 0;
+    uint32_t count = 0;
+    while (count < r.node_count && pos < r.word_count) {
+        r.offsets[count] = pos;
+        if (!(r.nodes[count] = image_alloc(&r, &pos))) break;
+        count++;
+    }
+    int ok = count == r.node_count && pos == r.word_count;
+    for (uint32_t i = 0; ok && i < count; i++) ok = image_link(&r, r.nodes[i], r.words + r.offsets[i]);
+    if (ok) {
+        roots = malloc((header->root_count ? header->root_count : 1) * sizeof(Node *));
+        for (uint32_t i = 0; ok && i < header->root_count; i++) roots[i] = image_node(&r, root_refs[i], &ok);
+    }
+    if (ok) {
+        // Walk 1 is the top level; walk i + 2 is the body of node i. A
+        // snapshot's roots are values, which never run as top-level forms.
+        uint32_t *seen = calloc(r.block->node_count ? r.block->node_count : 1, sizeof(uint32_t));
+        int forms = strcmp(magic, IMAGE_MAGIC) == 0;
+        for (uint32_t i = 0; ok && forms && i < header->root_count; i++) ok = image_check_refs(&r, roots[i], NULL, seen, 1);
+        for (uint32_t i = 0; ok && i < r.block->node_count; i++) {
+            Node *node = &r.block->nodes[i];
+            if (node->type == DEF && node->value.compound.child_count == 3) {
+                ok = image_check_refs(&r, node->value.compound.children[2], node, seen, i + 2);
+            }
+        }
+        free(seen);
+    }
+    if (ok) {
+        *root_count = header->root_count;
+        r.block->next = interp->images;
+        interp->images = r.block;
+    } else {
+        free(roots);
+        roots = NULL;
+        for (uint32_t i = 0; i < r.block->node_count; i++) image_block_free_node(&r.block->nodes[i]);
+        free(r.block->nodes);
+        free(r.block->children);
+        free(r.block->strings);
+        free(r.block);
+    }
+    free(r.nodes);
+    free(r.offsets);
+    munmap(map, st.st_size);
+    return roots;
+}
+
+int ls_save_image(ls_script *script, const char *path) {
+    return image_save(script->forms, script->count, IMAGE_MAGIC, path);
+}
+
+ls_script *ls_load_image(ls_interp *ls, const char *path) {
+    Interp *saved = interp_bind(ls);
+    ensure_thread_state();
+    int count;
+    Node **forms = image_load(path, IMAGE_MAGIC, &count);
+    Script *script = NULL;
+    for (int i = 0; forms && i < count; i++) {
+        if (!forms[i]) {
+            free(forms);
+            forms = NULL;
+        }
+    }
+    if (forms) {
+        script = script_new(ls);
+        script->forms = forms;
+        script->count = count;
+        script_finish(script);
+    }
+    interp = saved;
+    return script;
+}
+
+// Saves the global bindings, except the built-ins, as a snapshot image.
+// Returns 0 if the file cannot be written.
+int snapshot_save(Env *env, const char *path) {
+    Node *names = calloc(env->count ? env->count : 1, sizeof(Node));
+    Node **roots = malloc((env->count ? env->count : 1) * 2 * sizeof(Node *));
+    int count = 0;
+    for (int i = 0; i < env->capacity; i++) {
+        Binding *binding = &env->slots[i];
+        if (!binding->name || is_builtin(binding)) continue;
+        Node *name = &names[count / 2];
+        name->type = SYMBOL;
+        name->flags = binding->constant ? NODE_CONST : 0;
+        name->value.name = binding->name;
+        roots[count++] = name;
+        roots[count++] = binding->value;
+    }
+    int ok = image_save(roots, count, SNAPSHOT_MAGIC, path);
+    free(roots);
+    free(names);
+    return ok;
+}
+
+// Binds the globals of a snapshot in one pass over the image, replacing
+// bindings of the same names. Its nodes are kept until the instance is freed.
+// Returns the number of bindings that clashed with a constant, or -1 if the
+// file is not a valid snapshot.
+int snapshot_restore(Env *env, const char *path) {
+    int count;
+    Node **roots = image_load(path, SNAPSHOT_MAGIC, &count);
+    if (!roots) return -1;
+    int clashes = 0;
+    for (int i = 0; i + 1 < count; i += 2) {
+        Node *name = roots[i];
+        if (!name || name->type != SYMBOL || !roots[i + 1]) continue;
+        if (!bind_global(env, name->value.name, roots[i + 1], name->flags & NODE_CONST)) clashes++;
+    }
+    free(roots);
+    return clashes;
+}
+
+/* --- Main Loop --- */
+
+// Parses, resolves and evaluates the top-level form starting at the current
+// token of `in` into *result. Returns 0 on a parse error.
+int eval_form(Interp *in, Node **result) {
+    Interp *saved = interp_bind(in);
+    ensure_thread_state();
+    // The previous form's AST and frames are released before parsing the next;
+    // only the globals are live between forms
+    arena_reset(&in->ast_arena);
+    frame_reset();
+    gc_safe_point();
+    alloc_arena = &in->ast_arena;
+    Node *parsed_exp = parse_expression();
+    if (parsed_exp) {
+        resolve(parsed_exp, NULL);
+        parsed_exp = fold(parsed_exp, &in->global_env);
+    }
+    alloc_arena = NULL;
+    if (parsed_exp) {
+        Env *env = &in->global_env;
+        *result = in->use_tree_walker ? eval(parsed_exp, env, NULL) : vm_eval(parsed_exp, env);
+    }
+    interp = saved;
+    return parsed_exp != NULL;
+}
+
+static const char *node_type_names[NODE_TYPE_COUNT] = {
+    [DEF] = "def", [ARGS] = "args", [LIST] = "list", [DATA] = "data", [IF] = "if",
+    [SYMBOL] = "symbol", [NUMBER] = "number", [PRIMITIVE_OP] = "primitive", [BOOLEAN] = "boolean",
+    [ERROR] = "error", [FUNCTION_CALL] = "call", [STRING] = "string", [LOCAL_REF] = "local",
+    [LIST_BUFFER] = "list buffer", [VECTOR] = "vector", [SEQ] = "sequence", [CLOSURE] = "closure",
+};
+
+static const char *primitive_name(int opcode) {
+    return opcode == OP_HOST ? "host" : primitives[opcode].name;
+}
+
+// Prints the counters of all threads, skipping node types and primitives never seen
+void print_stats() {
+    ThreadStats total;
+    stats_total(&total);
+    for (int i = 0; i < NODE_TYPE_COUNT; i++) {
+        if (total.nodes[i]) out_printf("evaluated %s: %ld\n", node_type_names[i], total.nodes[i]);
+    }
+    for (int i = 0; i <= OP_HOST; i++) {
+        if (total.primitive_calls[i]) out_printf("calls to %s: %ld\n", primitive_name(i), total.primitive_calls[i]);
+    }
+    out_printf("allocations: %ld\n", total.allocations);
+    out_printf("allocated bytes: %ld\n", total.allocation_bytes);
+    out_printf("max depth: %ld\n", total.max_depth);
+    out_printf("global lookups: %ld\n", total.global_lookups);
+    out_printf("average probe length: %.3f\n", total.global_lookups ? (double)total.global_probes / total.global_lookups : 0.0);
+    out_printf("local lookups: %ld\n", total.local_lookups);
+    out_printf("closures: %ld\n", total.closures);
+    out_printf("captured values: %ld\n", total.captured);
+}
+
+// The same counters as one line of JSON, with every node type and primitive
+void print_stats_json() {
+    ThreadStats total;
+    stats_total(&total);
+    out_printf("{\"nodes\":{");
+    for (int i = 0; i < NODE_TYPE_COUNT; i++) out_printf(i ? ",\"%s\":%ld" : "\"%s\":%ld", node_type_names[i], total.nodes[i]);
+    out_printf("},\"primitive_calls\":{");
+    for (int i = 0, first = 1; i <= OP_HOST; i++) {
+        if (i == OP_COUNT) continue;
+        out_printf(first ? "\"%s\":%ld" : ",\"%s\":%ld", primitive_name(i), total.primitive_calls[i]);
+        first = 0;
+    }
+    out_printf("},\"allocations\":%ld,\"allocation_bytes\":%ld,\"max_depth\":%ld,"
+               "\"global_lookups\":%ld,\"global_probes\":%ld,\"local_lookups\":%ld,\"closures\":%ld,\"captured\":%ld}\n",
+               total.allocations, total.allocation_bytes, total.max_depth, total.global_lookups, total.global_probes,
+               total.local_lookups, total.closures, total.captured);
+}
+
+// Runs the REPL commands that start with ':'. Returns 0 if the token is not one.
+int run_command(Interp *in) {
+    if (token_is(":gc-stats")) {
+        print_gc_stats();
+    } else if (token_is(":env-stats")) {
+        print_env_stats(&in->global_env);
+    } else if (token_is(":stats")) {
+        print_stats();
+    } else if (token_is(":stats-json")) {
+        print_stats_json();
+    } else if (command_takes_path()) {
+        int save = token_is(":save");
+        if (!gettoken()) {
+            fprintf(stderr, "%s needs a file name\n", save ? ":save" : ":restore");
+            return 1;
+        }
+        char *path = strndup(interp->token, interp->token_length);
+        if (save && !snapshot_save(&in->global_env, path)) {
+            fprintf(stderr, "Cannot write %s\n", path);
+        } else if (!save) {
+            int clashes = snapshot_restore(&in->global_env, path);
+            if (clashes < 0) fprintf(stderr, "Cannot restore %s\n", path);
+            else if (clashes) fprintf(stderr, "%d constant%s not restored\n", clashes, clashes == 1 ? "" : "s");
+        }
+        free(path);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Runs every top-level form of a script, printing only errors. Returns the exit status.
+int run_script(Interp *in, const char *path) {
+    Interp *saved = interp_bind(in);
+    int status = 0;
+    if (!read_file(path)) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        status = 1;
+    } else while (gettoken() && !token_is("bye")) {
+        if (run_command(in)) continue;
+        Node *result = NULL;
+        if (!eval_form(in, &result)) {
+            out_cstr("Parse error.\n");
+            status = 1;
+            break;
+        }
+        if (result && result->type == ERROR) {
+            print_node(result);
+            out_char('\n');
+            status = 1;
+        }
+    }
+    out_end();
+    interp = saved;
+    return status;
+}
+
+// Compiles a script to an image at `out` without running it. Returns the exit status.
+int compile_image(Interp *in, const char *path, const char *out) {
+    Interp *saved = interp_bind(in);
+    int status = 1;
+    if (!read_file(path)) {
+        fprintf(stderr, "Cannot read %s\n", path);
+    } else {
+        Script *script = ls_compile(in, in->input_buffer);
+        if (!script) {
+            out_cstr("Parse error.\n");
+        } else if (!ls_save_image(script, out)) {
+            fprintf(stderr, "Cannot write %s\n", out);
+        } else {
+            status = 0;
+        }
+    }
+    interp = saved;
+    return status;
+}
+
+// Runs every form of an image like run_script runs a file's
+int run_image(Interp *in, const char *path) {
+    Script *script = ls_load_image(in, path);
+    if (!script) {
+        fprintf(stderr, "Cannot load image %s\n", path);
+        return 1;
+    }
+    Interp *saved = interp_bind(in);
+    int status = 0;
+    for (int i = 0; i < script->count; i++) {
+        Node *result = script_run_form(script, i);
+        if (result->type == ERROR) {
+            print_node(result);
+            out_char('\n');
+            status = 1;
+        }
+    }
+    out_end();
+    interp = saved;
+    return status;
+}
+
+#ifndef LISTSCRIPT_NO_MAIN
+int main(int argc, char **argv) {
+    char stack_top;
+    init_stack_limit(&stack_top);
+    init_thread_state();
+    const char *script = NULL;
+    const char *image_out = NULL;
+    const char *image = NULL;
+    int async_output = 0;
+    Interp *in = interp_new();
+    interp = in; // The REPL below runs on this instance
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--tree-walk") == 0) {
+            in->use_tree_walker = 1;
+        } else if (strcmp(argv[i], "--heap-limit") == 0 && i + 1 < argc) {
+            in->heap_limit = strtoul(argv[++i], NULL, 10) * 1024 * 1024;
+            if (in->heap_limit && in->gc_threshold > in->heap_limit) in->gc_threshold = in->heap_limit;
+        } else if (strcmp(argv[i], "--run") == 0 && i + 1 < argc) {
+            script = argv[++i];
+        } else if (strcmp(argv[i], "--compile-image") == 0 && i + 1 < argc) {
+            image_out = argv[++i];
+        } else if (strcmp(argv[i], "--load-image") == 0 && i + 1 < argc) {
+            image = argv[++i];
+        } else if (strcmp(argv[i], "--memo-size") == 0 && i + 1 < argc) {
+            in->memo_limit = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+            if (thread_count < 1) thread_count = 1;
+        } else if (strcmp(argv[i], "--async-output") == 0) {
+            async_output = 1;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profiling = 1;
+        } else if (strcmp(argv[i], "--profile-stacks") == 0 && i + 1 < argc) {
+            profiling = 1;
+            in->profile_stacks_path = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--tree-walk] [--heap-limit <megabytes>] [--memo-size <entries>] [--threads <count>] [--async-output] [--profile] [--profile-stacks <file>] [--run <file> [--compile-image <image>]] [--load-image <image>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    out_line_flush = isatty(STDOUT_FILENO);
+    if (async_output) out_start_async();
+    atexit(out_flush);
+
+    if (image_out) {
+        if (script) return compile_image(in, script, image_out);
+        fprintf(stderr, "--compile-image needs a script to compile: --run <file>\n");
+        return 1;
+    }
+    if (image) {
+        int status = run_image(in, image);
+        if (profiling) profile_report();
+        return status;
+    }
+    if (script) {
+        int status = run_script(in, script);
+        if (profiling) profile_report();
+        return status;
+    }
+    
+    out_cstr("ListScript ready.\n");
+    while (1) {
+        out_prompt("-> ");
+        if (!read_line()) break;
+        if (!gettoken()) continue;
+        
+        if (token_is("bye")) {
+            out_cstr("Bye!\n");
+            break;
+        }
+        if (run_command(in)) continue;
+
+        Node *result = NULL;
+        if (eval_form(in, &result)) {
+            if (result) {
+                print_node(result);
+                out_char('\n');
+            }
+        } else {
+            out_cstr("Parse error.\n");
+        }
+    }
+    if (profiling) profile_report();
+    return 0;
+}
+#endif
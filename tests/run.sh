@@ -0,0 +1,58 @@
+#!/bin/sh
+# Builds listscriptV6.c and feeds each tests/name.ls to its REPL, comparing
+# the values it prints with tests/name.out. Usage: tests/run.sh
+#
+# The banner, the "-> " prompts, "Bye!" and blank lines are dropped before
+# comparing, so name.out holds one printed value per line.
+#
+# tests/images/locals.ls is compiled to an image, which must run like the
+# script, and then corrupted, which must make --load-image refuse it.
+set -e
+
+TESTS_DIR=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(dirname "$TESTS_DIR")
+BUILD=${BUILD:-$TESTS_DIR/build}
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2}
+
+mkdir -p "$BUILD"
+$CC $CFLAGS -pthread "$ROOT/listscriptV6.c" -o "$BUILD/listscriptV6"
+set +e
+
+failed=0
+for test in "$TESTS_DIR"/*.ls; do
+    name=$(basename "$test" .ls)
+    { cat "$test"; echo bye; } | "$BUILD/listscriptV6" 2>&1 |
+        sed -e 's/^\(-> \)*//' | grep -v -e '^ListScript ready\.$' -e '^Bye!$' -e '^$' > "$BUILD/$name.txt"
+    if diff -u "$TESTS_DIR/$name.out" "$BUILD/$name.txt"; then
+        echo "ok   $name"
+    else
+        echo "FAIL $name"
+        failed=1
+    fi
+done
+
+# Run from its image, locals.ls must print what it prints as a script
+image=$BUILD/locals.lsi
+"$BUILD/listscriptV6" --run "$TESTS_DIR/images/locals.ls" > "$BUILD/locals.txt" 2>&1
+"$BUILD/listscriptV6" --run "$TESTS_DIR/images/locals.ls" --compile-image "$image"
+if "$BUILD/listscriptV6" --load-image "$image" 2>&1 | diff -u "$BUILD/locals.txt" -; then
+    echo "ok   image"
+else
+    echo "FAIL image"
+    failed=1
+fi
+
+# The image keeps its words in native order; a LOCAL_REF record is 12 (its
+# type), name, slot, captured. Pointing the captured reference, k in times,
+# at slot 5 leaves it inside the image but outside times's frame of 3 slots.
+slot=$(od -An -v -t u4 -w4 "$image" | awk '{ w[NR - 1] = $1 } END { for (i = 0; i < NR; i++) if (w[i] == 12 && w[i + 3] == 1) { print i + 2; exit } }')
+cp "$image" "$BUILD/bad-slot.lsi"
+printf '\5\0\0\0' | dd of="$BUILD/bad-slot.lsi" bs=4 seek="$slot" conv=notrunc 2>/dev/null
+if "$BUILD/listscriptV6" --load-image "$BUILD/bad-slot.lsi" 2>&1 | grep -q '^Cannot load image'; then
+    echo "ok   image-bad-slot"
+else
+    echo "FAIL image-bad-slot"
+    failed=1
+fi
+exit $failed